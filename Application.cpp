@@ -1,9 +1,149 @@
+#include <cstdio>
+#include <cstring>
 #include <sstream>
 #include <iostream>
 #include <Application.hpp>
+#include <Checkpoint.hpp>
+#include <DirectIllumination.hpp>
+#include <Denoiser.hpp>
+
+#include <tbb/parallel_reduce.h>
 
 namespace haste {
 
+// Block sizes of the preview passes, they cover 1/16 and 1/4 of the pixels.
+static const size_t previewBlocks[] = { 4, 2 };
+static const size_t numPreviewStages = sizeof(previewBlocks) / sizeof(previewBlocks[0]);
+
+void upsampleBlocks(
+    vec4* dst,
+    size_t width,
+    size_t height,
+    const vec4* src,
+    size_t block)
+{
+    const size_t srcWidth = (width + block - 1) / block;
+
+    for (size_t y = 0; y < height; ++y) {
+        for (size_t x = 0; x < width; ++x) {
+            const vec4& pixel = src[(y / block) * srcWidth + x / block];
+
+            dst[y * width + x] = pixel.w != 0.0f
+                ? vec4(pixel.rgb() / pixel.w, 1.0f)
+                : vec4(0.0f);
+        }
+    }
+}
+
+#ifndef HASTE_HEADLESS
+static const size_t postprocGrain = 16 * 1024;
+static const float relMSEEpsilon = 0.01f; // keeps black reference pixels finite
+static const float relErrorEpsilon = 0.1f; // the same for first order errors
+
+// Sums over the displayed image, joined across chunks by parallel_reduce.
+struct PostprocStats {
+    vec3 sum = vec3(0.0f);
+    double absError = 0.0;
+    double relError = 0.0;
+    double squaredError = 0.0;
+    double relSquaredError = 0.0;
+    float maxError = 0.0f;
+
+    void join(const PostprocStats& that) {
+        sum += that.sum;
+        absError += that.absError;
+        relError += that.relError;
+        squaredError += that.squaredError;
+        relSquaredError += that.relSquaredError;
+        maxError = std::max(maxError, that.maxError);
+    }
+};
+
+void postprocCopy(
+    PostprocStats& stats,
+    vec4* dst,
+    const vec4* src,
+    size_t begin,
+    size_t end)
+{
+    vec3 sum = vec3(0.0f);
+
+    for (size_t i = begin; i < end; ++i) {
+        sum += src[i].rgb() / src[i].a;
+        dst[i] = src[i];
+    }
+
+    stats.sum += sum;
+}
+
+// Errors are measured on the lengths of the rgb vectors, the lengths of
+// the reference are computed once on load. The loop has no mode dependent
+// branches besides loop invariant ones, so it vectorizes.
+void postprocErrors(
+    PostprocStats& stats,
+    vec4* dst,
+    const vec4* src,
+    const float* references,
+    const vec4* referenceImage,
+    DisplayMode mode,
+    size_t begin,
+    size_t end)
+{
+    const bool relative =
+        mode == DisplayModeUnsignedRelative ||
+        mode == DisplayModeRelative;
+
+    const bool signedError =
+        mode == DisplayModeRelative ||
+        mode == DisplayModeAbsolute;
+
+    const bool error = mode != DisplayModeCurrent && mode != DisplayModeReference;
+
+    vec3 sum = vec3(0.0f);
+    float absError = 0.0f;
+    float relError = 0.0f;
+    float squaredError = 0.0f;
+    float relSquaredError = 0.0f;
+    float maxError = stats.maxError;
+
+    for (size_t i = begin; i < end; ++i) {
+        const vec3 radiance = src[i].rgb() * (1.0f / src[i].a);
+        const float current = length(radiance);
+        const float reference = references[i];
+        const float difference = current - reference;
+        const float absolute = abs(difference);
+        const float relativeError = absolute / (reference + relErrorEpsilon);
+        const float displayed = relative ? relativeError : absolute;
+
+        sum += radiance;
+        absError += absolute;
+        relError += relativeError;
+        squaredError += difference * difference;
+        relSquaredError += difference * difference / (reference * reference + relMSEEpsilon);
+        maxError = std::max(maxError, displayed);
+
+        if (!error) {
+            dst[i] = mode == DisplayModeCurrent ? src[i] : referenceImage[i];
+        }
+        else if (!signedError) {
+            dst[i] = vec4(vec3(displayed), 1.0f);
+        }
+        else {
+            dst[i] = difference < 0.0f
+                ? vec4(0.0f, 0.0f, displayed, 1.0f)
+                : vec4(displayed, 0.0f, 0.0f, 1.0f);
+        }
+    }
+
+    stats.sum += sum;
+    stats.absError += absError;
+    stats.relError += relError;
+    stats.squaredError += squaredError;
+    stats.relSquaredError += relSquaredError;
+    stats.maxError = maxError;
+}
+#endif
+
 Application::Application(const Options& options) {
     _options = options;
 
@@ -11,9 +151,22 @@ Application::Application(const Options& options) {
     runtime_assert(_device != nullptr);
 
     _technique = makeTechnique(options);
+    _denoise = options.denoise;
+    _resumePending = options.resume;
+
+    if (_options.preview) {
+        _preview = make_shared<DirectIllumination>();
+    }
+    else {
+        _previewStage = numPreviewStages + 1;
+    }
+#ifndef HASTE_HEADLESS
     _ui = make_shared<UserInterface>(options.input, _scale);
+    _ui->denoise = options.denoise;
+#endif
 
     _modificationTime = 0;
+    _dynamic = !_options.batch && _options.reload;
 
     bool reload = _options.reload;
     _options.reload = true;
@@ -26,23 +179,72 @@ Application::Application(const Options& options) {
             _options.width,
             _options.height,
             _reference);
+
+        _referenceLengths.resize(_reference.size());
+
+        for (size_t i = 0; i < _reference.size(); ++i) {
+            _referenceLengths[i] = length(_reference[i].rgb());
+        }
     }
 
     std::cout << "Using: " << _technique->name() << std::endl;
 
-    _startTime = glfwGetTime();
+    _startTime = secondsSinceStart();
 }
 
 Application::~Application() {
+    if (_writer.joinable()) {
+        _writer.join();
+    }
+
     rtcDeleteDevice(_device);
 }
 
 void Application::render(size_t width, size_t height, glm::vec4* data) {
+    if (_preview && (_width != width || _height != height)) {
+        _previewStage = 0;
+    }
+
+    _width = width;
+    _height = height;
+
+    if (_previewStage < numPreviewStages) {
+        _renderPreview(width, height, data);
+        return;
+    }
+
+    // The preview hands over to the technique which starts from scratch.
+    if (_previewStage == numPreviewStages) {
+        std::memset(data, 0, width * height * sizeof(vec4));
+        _albedo.clear();
+        _normal.clear();
+        _moments.clear();
+        ++_previewStage;
+    }
+
+    if (_options.features && _albedo.size() != width * height) {
+        _albedo.assign(width * height, vec4(0.0f));
+        _normal.assign(width * height, vec4(0.0f));
+        _moments.assign(width * height, 0.0f);
+    }
+
     if (_preprocessed) {
-        auto view = ImageView(data, width, height);
+        auto view = _featureView(data, width, height);
+
+        if (_resumePending) {
+            _resumeCheckpoint(view);
+            _resumePending = false;
+        }
+
         _technique->render(view, _engine, _options.cameraId, _options.parallel);
 
-        double elapsed = glfwGetTime() - _startTime;
+        // Interrupted passes are followed by a reload or a resize anyway.
+        if (_technique->interrupted()) {
+            return;
+        }
+
+        double elapsed = secondsSinceStart() - _startTime;
+        _checkpointIfRequired(view, elapsed);
         _saveIfRequired(view, elapsed);
         _updateQuitCond(view, elapsed);
     }
@@ -52,122 +254,225 @@ void Application::render(size_t width, size_t height, glm::vec4* data) {
     }
 }
 
+int Application::runTiled(size_t width, size_t height) {
+    _technique->preprocess(_scene, _engine, [](string, float) {});
+    _preprocessed = true;
+
+    const string path = _outputPath(width, height, _options.numSamples, false);
+    const size_t tileSize = _options.tileSize;
+
+    TiledEXRWriter writer(path, width, height, tileSize, _options.features, _options.halfFloat);
+
+    // Only the current row of tiles is resident, it's rendered to the end,
+    // streamed to the file and its buffer reused for the next one.
+    vector<vec4> rows(width * tileSize);
+
+    if (_options.features) {
+        _albedo.resize(rows.size());
+        _normal.resize(rows.size());
+    }
+
+    for (size_t tileRow = 0; tileRow < writer.numTileRows(); ++tileRow) {
+        const size_t yBegin = writer.yBegin(tileRow);
+        const size_t yEnd = writer.yEnd(tileRow);
+
+        auto view = ImageView(rows.data(), width, height, yBegin, yEnd);
+
+        if (_options.features) {
+            view._albedo = _albedo.data();
+            view._normal = _normal.data();
+        }
+
+        view.clear();
+
+        for (size_t i = 0; i < _options.numSamples; ++i) {
+            _technique->render(view, _engine, _options.cameraId, _options.parallel);
+        }
+
+        if (_options.features) {
+            writer.writeTileRow(tileRow, rows.data(), _albedo.data(), _normal.data());
+        }
+        else {
+            writer.writeTileRow(tileRow, rows.data());
+        }
+
+        std::cout << "Tile row " << tileRow + 1 << "/" << writer.numTileRows()
+            << " written." << std::endl;
+    }
+
+    std::cout << "Result saved to `" << path << "`." << std::endl;
+
+    return 0;
+}
+
 void Application::updateUI(size_t width, size_t height, const glm::vec4* data) {
+#ifndef HASTE_HEADLESS
     _ui->update(
         *_technique,
         width,
         height,
         data,
         0.0f);
-}
-
-void Application::postproc(glm::vec4* dst, const glm::vec4* src, size_t width, size_t height) {
-    size_t size = width * height;
-
-    if (_ui->computeAverage)
-    {
-        _ui->averageValue = vec3(0.f, 0.f, 0.f);
 
-        for (size_t i = 0; i < size; ++i) {
-            _ui->averageValue += src[i].rgb() / src[i].a;
-        }
+    _denoise = _ui->denoise;
+#endif
+}
 
-        _ui->averageValue /= float(size);
+void Application::present(glm::vec4* dst, const glm::vec4* src, size_t width, size_t height) {
+    // The features are empty until the technique takes over from the preview.
+    if (_denoise && _moments.size() == width * height) {
+        _denoiser.denoise(dst, _featureView((vec4*)src, width, height));
     }
+    else {
+        Framework::present(dst, src, width, height);
+    }
+}
 
-    if (_reference.size() == 0) {
-        Framework::postproc(dst, src, width, height);
+void Application::postproc(glm::vec4* dst, const glm::vec4* src, size_t width, size_t height) {
+#ifdef HASTE_HEADLESS
+    Framework::postproc(dst, src, width, height);
+#else
+    const size_t size = width * height;
+    const bool compare = _referenceLengths.size() == size;
+
+    PostprocStats stats = tbb::parallel_reduce(
+        tbb::blocked_range<size_t>(0, size, postprocGrain),
+        PostprocStats(),
+        [&](const tbb::blocked_range<size_t>& range, PostprocStats stats) {
+            if (compare) {
+                postprocErrors(
+                    stats,
+                    dst,
+                    src,
+                    _referenceLengths.data(),
+                    _reference.data(),
+                    _ui->displayMode,
+                    range.begin(),
+                    range.end());
+            }
+            else {
+                postprocCopy(stats, dst, src, range.begin(), range.end());
+            }
+
+            return stats;
+        },
+        [](PostprocStats a, const PostprocStats& b) {
+            a.join(b);
+            return a;
+        });
+
+    if (_ui->computeAverage) {
+        _ui->averageValue = stats.sum / float(size);
     }
-    else {
-        _ui->maxError = 0.0f;
 
-        switch (_ui->displayMode)
-        {
-            case DisplayModeUnsignedRelative:
-                for (size_t i = 0; i < _reference.size(); ++i) {
-                    float current = length(src[i].rgb() / src[i].a);
-                    float reference = length(_reference[i].rgb());
-                    float error = abs(current - reference) / reference;
+    if (compare) {
+        _ui->maxError = stats.maxError;
+        _ui->avgAbsError = float(stats.absError / double(size));
+        _ui->avgRelError = float(stats.relError / double(size));
+        _ui->rmse = float(sqrt(stats.squaredError / double(size)));
+        _ui->relMSE = float(stats.relSquaredError / double(size));
+        _ui->maxErrors.push_back(_ui->maxError);
+    }
+#endif
+}
 
-                    _ui->maxError = std::max(_ui->maxError, error);
+bool Application::updateScene() {
+    if (_options.reload) {
+        auto modificationTime = getmtime(_options.input);
 
-                    dst[i] = vec4(vec3(error), 1.0f);
+        if (_modificationTime < modificationTime) {
+            auto scene = loadScene(_options);
+            unsigned changes = _scene ? _scene->diff(*scene) : SceneChangeTopology;
+
+            // Saved without changes, the accumulated image stays valid.
+            if (changes == SceneChangeNone) {
+                _modificationTime = modificationTime;
+                return false;
+            }
+
+            if (changes & SceneChangeTopology) {
+                _scene = scene;
+                _scene->buildAccelStructs(_device, _dynamic);
+                _preprocessed = false;
+            }
+            else {
+                _scene->update(std::move(*scene), changes);
+
+                // Photon maps etc. don't depend on the cameras.
+                if (changes != SceneChangeCameras) {
+                    _preprocessed = false;
                 }
+            }
 
-                break;
-
-            case DisplayModeUnsignedAbsolute:
-                _ui->avgAbsError = 0.0f;
-
-                for (size_t i = 0; i < _reference.size(); ++i) {
-                    float current = length(src[i].rgb() / src[i].a);
-                    float reference = length(_reference[i].rgb());
-                    float error = abs(current - reference);
-
-                    _ui->maxError = std::max(_ui->maxError, error);
-
-                    dst[i] = vec4(vec3(error), 1.0f);
-                }
+            _modificationTime = modificationTime;
 
-                break;
+            // The accumulation buffer is cleared by the framework.
+            _albedo.clear();
+            _normal.clear();
+            _moments.clear();
 
-            case DisplayModeRelative:
-                for (size_t i = 0; i < _reference.size(); ++i) {
-                    float current = length(src[i].rgb() / src[i].a);
-                    float reference = length(_reference[i].rgb());
-                    float error = abs(current - reference) / reference;
+            if (_preview) {
+                _previewStage = 0;
+            }
 
-                    _ui->maxError = std::max(_ui->maxError, error);
+            return true;
+        }
+    }
 
-                    dst[i] = current < reference
-                        ? vec4(0.0f, 0.0f, error, 1.0f)
-                        : vec4(error, 0.0f, 0.0f, 1.0f);
-                }
+    return false;
+}
 
-                break;
+bool Application::interruptRequired() {
+    if (!_options.reload) {
+        return false;
+    }
 
-            case DisplayModeAbsolute:
-                for (size_t i = 0; i < _reference.size(); ++i) {
-                    float current = length(src[i].rgb() / src[i].a);
-                    float reference = length(_reference[i].rgb());
-                    float error = abs(current - reference);
+    // Once per modification, the render thread may not have reloaded yet.
+    auto modificationTime = getmtime(_options.input);
 
-                    _ui->maxError = std::max(_ui->maxError, error);
+    if (_modificationTime < modificationTime && _interruptTime != modificationTime) {
+        _interruptTime = modificationTime;
+        return true;
+    }
 
-                    dst[i] = current < reference
-                        ? vec4(0.0f, 0.0f, error, 1.0f)
-                        : vec4(error, 0.0f, 0.0f, 1.0f);
-                }
+    return false;
+}
 
-                break;
+void Application::interrupt() {
+    _technique->interrupt();
 
-            case DisplayModeCurrent:
-                Framework::postproc(dst, src, width, height);
-                break;
+    if (_preview) {
+        _preview->interrupt();
+    }
+}
 
-            case DisplayModeReference:
-                Framework::postproc(dst, _reference.data(), width, height);
-                break;
-        }
+void Application::resume() {
+    _technique->resume();
 
-        _ui->maxErrors.push_back(_ui->maxError);
+    if (_preview) {
+        _preview->resume();
     }
 }
 
-bool Application::updateScene() {
-    if (_options.reload) {
-        auto modificationTime = getmtime(_options.input);
+void Application::_renderPreview(size_t width, size_t height, glm::vec4* data) {
+    const size_t block = previewBlocks[_previewStage];
+    const size_t previewWidth = (width + block - 1) / block;
+    const size_t previewHeight = (height + block - 1) / block;
 
-        if (_modificationTime < modificationTime) {
-            _scene = loadScene(_options);
-            _scene->buildAccelStructs(_device);
-            _preprocessed = false;
-            _modificationTime = modificationTime;
-            return true;
-        }
+    // Doesn't wait for the preprocessing of the technique (e.g. photons).
+    if (_previewStage == 0) {
+        _preview->preprocess(_scene, _engine, [](string, float) {});
     }
 
-    return false;
+    _previewBuffer.assign(previewWidth * previewHeight, vec4(0.0f));
+
+    auto view = ImageView(_previewBuffer.data(), previewWidth, previewHeight);
+    _preview->render(view, _engine, _options.cameraId, _options.parallel);
+
+    if (!_preview->interrupted()) {
+        upsampleBlocks(data, width, height, _previewBuffer.data(), block);
+        ++_previewStage;
+    }
 }
 
 void Application::_saveIfRequired(const ImageView& view, double elapsed) {
@@ -202,7 +507,12 @@ void Application::_updateQuitCond(const ImageView& view, double elapsed) {
     }
 }
 
-void Application::_save(const ImageView& view, size_t numSamples, bool snapshot) {
+string Application::_outputPath(
+    size_t width,
+    size_t height,
+    size_t numSamples,
+    bool snapshot) const
+{
     string path;
     bool hasSamples = false;
 
@@ -211,8 +521,8 @@ void Application::_save(const ImageView& view, size_t numSamples, bool snapshot)
         std::stringstream stream;
         stream
             << split.first << "."
-            << view.width() << "."
-            << view.height() << "."
+            << width << "."
+            << height << "."
             << numSamples << "."
             << techniqueString(_options) << ".exr";
         path = stream.str();
@@ -237,14 +547,161 @@ void Application::_save(const ImageView& view, size_t numSamples, bool snapshot)
         path = stream.str();
     }
 
-    saveEXR(path, view.width(), view.height(), view.data());
+    return path;
+}
+
+string Application::_checkpointPath(size_t width, size_t height) const {
+    std::stringstream stream;
+
+    if (_options.output.empty()) {
+        stream
+            << splitext(_options.input).first << "."
+            << width << "."
+            << height << "."
+            << techniqueString(_options);
+    }
+    else {
+        stream << splitext(_options.output).first;
+    }
+
+    stream << ".checkpoint";
+
+    return stream.str();
+}
+
+void Application::_checkpointIfRequired(const ImageView& view, double elapsed) {
+    if (_options.checkpoint == 0.0 || elapsed - _checkpointTime < _options.checkpoint) {
+        return;
+    }
+
+    Checkpoint checkpoint;
+    checkpoint.technique = techniqueString(_options);
+    checkpoint.numSamples = size_t(view.last().w);
+    checkpoint.elapsed = elapsed;
+    checkpoint.engine = _engine.state();
+    _technique->saveState(checkpoint.state);
+
+    const string path = _checkpointPath(view.width(), view.height());
+
+    if (writeCheckpoint(path, checkpoint, view)) {
+        std::cout << "Checkpoint saved to `" << path << "` ("
+            << checkpoint.numSamples << " samples)." << std::endl;
+    }
+    else {
+        std::cout << "Failed to save checkpoint to `" << path << "`." << std::endl;
+    }
+
+    _checkpointTime = elapsed;
+}
+
+void Application::_resumeCheckpoint(ImageView& view) {
+    const string path = _checkpointPath(view.width(), view.height());
+
+    Checkpoint checkpoint;
+
+    if (!readCheckpoint(checkpoint, view, path)) {
+        std::cout << "No usable checkpoint at `" << path
+            << "`, starting from scratch." << std::endl;
+        return;
+    }
+
+    if (checkpoint.technique != techniqueString(_options) ||
+        !_engine.restore(checkpoint.engine) ||
+        !_technique->loadState(checkpoint.state)) {
+        view.clear();
+        std::cout << "Checkpoint `" << path << "` was made with different options, "
+            << "starting from scratch." << std::endl;
+        return;
+    }
+
+    // The time limit and the snapshots count the time before the kill too.
+    _startTime = secondsSinceStart() - checkpoint.elapsed;
+    _checkpointTime = checkpoint.elapsed;
+
+    std::cout << "Resumed from `" << path << "` at "
+        << checkpoint.numSamples << " samples." << std::endl;
+}
+
+void Application::_save(const ImageView& view, size_t numSamples, bool snapshot) {
+    const string path = _outputPath(view.width(), view.height(), numSamples, snapshot);
+
+    // At most one snapshot is written at a time, the result goes last.
+    if (_writer.joinable()) {
+        _writer.join();
+    }
 
     if (snapshot) {
-        std::cout << "Snapshot saved to `" << path << "`." << std::endl;
+        const size_t width = view.width();
+        const size_t height = view.height();
+        const bool halfFloat = _options.halfFloat;
+
+        _snapshot.assign(view.data(), view.data() + width * height);
+        _snapshotAlbedo = _albedo;
+        _snapshotNormal = _normal;
+
+        _writer = std::thread([=]() {
+            if (_snapshotAlbedo.empty()) {
+                saveEXR(path, width, height, _snapshot.data(), halfFloat);
+            }
+            else {
+                saveEXR(
+                    path,
+                    width,
+                    height,
+                    _snapshot.data(),
+                    _snapshotAlbedo.data(),
+                    _snapshotNormal.data(),
+                    halfFloat);
+            }
+
+            std::cout << "Snapshot saved to `" << path << "`." << std::endl;
+        });
     }
     else {
+        if (_albedo.empty()) {
+            saveEXR(path, view.width(), view.height(), view.data(), _options.halfFloat);
+        }
+        else {
+            saveEXR(
+                path,
+                view.width(),
+                view.height(),
+                view.data(),
+                _albedo.data(),
+                _normal.data(),
+                _options.halfFloat);
+        }
+
         std::cout << "Result saved to `" << path << "`." << std::endl;
+
+        // Nothing left to resume.
+        if (_options.checkpoint != 0.0) {
+            std::remove(_checkpointPath(view.width(), view.height()).c_str());
+        }
+
+        if (_options.denoise && !_moments.empty()) {
+            auto split = splitext(path);
+            const string denoisedPath = split.first + ".denoised" + split.second;
+
+            vector<vec4> denoised(view.width() * view.height());
+            denoise(denoised.data(), view);
+            saveEXR(denoisedPath, view.width(), view.height(), denoised.data(), _options.halfFloat);
+
+            std::cout << "Denoised result saved to `" << denoisedPath << "`." << std::endl;
+        }
     }
 }
 
+ImageView Application::_featureView(glm::vec4* data, size_t width, size_t height) {
+    auto view = ImageView(data, width, height);
+
+    if (_options.features) {
+        view._albedo = _albedo.data();
+        view._normal = _normal.data();
+        view._moments = _moments.data();
+    }
+
+    return view;
+}
+
 }
@@ -1,9 +1,13 @@
 #pragma once
+#include <thread>
 #include <framework.hpp>
 #include <Options.hpp>
+#ifndef HASTE_HEADLESS
 #include <UserInterface.hpp>
+#endif
 #include <Scene.hpp>
 #include <Technique.hpp>
+#include <Denoiser.hpp>
 
 namespace haste {
 
@@ -15,24 +19,59 @@ public:
     void render(size_t width, size_t height, glm::vec4* data) override;
     void updateUI(size_t width, size_t height, const glm::vec4* data) override;
     void postproc(glm::vec4* dst, const glm::vec4* src, size_t width, size_t height) override;
+    void present(glm::vec4* dst, const glm::vec4* src, size_t width, size_t height) override;
 
     bool updateScene() override;
 
+    // Out-of-core batch rendering, see Options::tileSize.
+    int runTiled(size_t width, size_t height);
+
+    bool interruptRequired() override;
+    void interrupt() override;
+    void resume() override;
+
 private:
+    void _renderPreview(size_t width, size_t height, glm::vec4* data);
     void _saveIfRequired(const ImageView& view, double elapsed);
     void _updateQuitCond(const ImageView& view, double elapsed);
+    string _outputPath(size_t width, size_t height, size_t numSamples, bool snapshot) const;
+    string _checkpointPath(size_t width, size_t height) const;
+    void _checkpointIfRequired(const ImageView& view, double elapsed);
+    void _resumeCheckpoint(ImageView& view);
     void _save(const ImageView& view, size_t numSamples, bool snapshot);
+    ImageView _featureView(glm::vec4* data, size_t width, size_t height);
 
 	Options _options;
 	RTCDevice _device;
 	RandomEngine _engine;
     shared<Technique> _technique;
+    shared<Technique> _preview;
+    size_t _previewStage = 0;
+    size_t _width = 0;
+    size_t _height = 0;
+    vector<vec4> _previewBuffer;
     shared<Scene> _scene;
     bool _preprocessed = false;
+    bool _dynamic = false;
+#ifndef HASTE_HEADLESS
     shared<UserInterface> _ui;
+#endif
     double _startTime;
-    size_t _modificationTime;
+    double _checkpointTime = 0.0; // elapsed time of the last checkpoint
+    bool _resumePending = false;
+    std::atomic<size_t> _modificationTime;
+    size_t _interruptTime = 0; // display thread only
     vector<vec4> _reference;
+    vector<float> _referenceLengths;
+    vector<vec4> _albedo; // feature buffers, see ImageView
+    vector<vec4> _normal;
+    vector<float> _moments;
+    std::atomic<bool> _denoise; // set by the display, read by the render thread
+    Denoiser _denoiser; // render thread only
+    vector<vec4> _snapshot; // owned by _writer while it runs
+    vector<vec4> _snapshotAlbedo;
+    vector<vec4> _snapshotNormal;
+    std::thread _writer;
 };
 
 }
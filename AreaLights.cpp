@@ -25,6 +25,10 @@ namespace haste {
 
 void AreaLights::init(const Intersector* intersector) {
     _intersector = intersector;
+
+    if (numLights() != 0) {
+        _updateSampler();
+    }
 }
 
 const size_t AreaLights::addLight(
@@ -35,9 +39,9 @@ const size_t AreaLights::addLight(
     const vec3& exitance,
     const vec2& size)
 {
-    size_t lightId = _names.size();
+    size_t lightId = _sources.size();
 
-    _names.push_back(name);
+    _addSource(name);
 
     Shape shape;
     shape.position = position;
@@ -47,42 +51,97 @@ const size_t AreaLights::addLight(
     _shapes.push_back(shape);
     _sizes.push_back(size);
     _exitances.push_back(exitance);
+    _areas.push_back(size.x * size.y);
+
+    const vec3 halfUp = up * 0.5f;
+    const vec3 halfLeft = normalize(cross(up, direction)) * 0.5f;
+
+    _corners.push_back(position - size.x * halfLeft - size.y * halfUp);
+    _corners.push_back(position + size.x * halfLeft - size.y * halfUp);
+    _corners.push_back(position + size.x * halfLeft + size.y * halfUp);
+    _corners.push_back(position - size.x * halfLeft + size.y * halfUp);
 
     _totalPower += lightPower(lightId);
     _totalArea += lightArea(lightId);
 
-    _updateSampler();
+    return lightId;
+}
+
+const size_t AreaLights::addLight(
+    const string& name,
+    const vec3& v0,
+    const vec3& v1,
+    const vec3& v2,
+    const vec3& exitance)
+{
+    size_t lightId = _sources.size();
+
+    _addSource(name);
+
+    const vec3 normal = cross(v1 - v0, v2 - v0);
+
+    Shape shape;
+    shape.position = (v0 + v1 + v2) / 3.0f;
+    shape.direction = normalize(normal);
+    shape.up = normalize(v1 - v0);
+
+    _shapes.push_back(shape);
+    _sizes.push_back(vec2(0.0f));
+    _exitances.push_back(exitance);
+    _areas.push_back(length(normal) * 0.5f);
+
+    _corners.push_back(v0);
+    _corners.push_back(v1);
+    _corners.push_back(v2);
+    _corners.push_back(v2);
+
+    _totalPower += lightPower(lightId);
+    _totalArea += lightArea(lightId);
 
     return lightId;
 }
 
 const size_t AreaLights::numLights() const {
-    return _names.size();
+    return _sources.size();
 }
 
 const string& AreaLights::name(size_t lightId) const {
-    runtime_assert(lightId < _names.size());
-    return _names[lightId];
+    runtime_assert(lightId < _sources.size());
+    return _names[_sources[lightId]];
+}
+
+void AreaLights::_addSource(const string& name) {
+    // Triangles of a mesh are added in a row, they share the name.
+    if (_names.empty() || _names.back() != name) {
+        _names.push_back(name);
+    }
+
+    _sources.push_back(uint32_t(_names.size() - 1));
+}
+
+const bool AreaLights::isTriangle(size_t lightId) const {
+    runtime_assert(lightId < _sources.size());
+    return _corners[lightId * 4 + 2] == _corners[lightId * 4 + 3];
 }
 
 const float AreaLights::lightArea(size_t lightId) const {
-    runtime_assert(lightId < _names.size());
-    return _sizes[lightId].x * _sizes[lightId].y;
+    runtime_assert(lightId < _sources.size());
+    return _areas[lightId];
 }
 
 const float AreaLights::lightPower(size_t lightId) const {
-    runtime_assert(lightId < _names.size());
+    runtime_assert(lightId < _sources.size());
     auto exitance = _exitances[lightId];
     return lightArea(lightId) * (exitance.x + exitance.y + exitance.z);
 }
 
 const vec3 AreaLights::lightNormal(size_t lightId) const {
-    runtime_assert(lightId < _names.size());
+    runtime_assert(lightId < _sources.size());
     return _shapes[lightId].direction;
 }
 
 const vec3 AreaLights::lightRadiance(size_t lightId) const {
-    runtime_assert(lightId < _names.size());
+    runtime_assert(lightId < _sources.size());
     return  _exitances[lightId] * one_over_pi<float>();
 }
 
@@ -126,7 +185,7 @@ const float AreaLights::density(
 {
     runtime_assert(_intersector != nullptr);
 
-    auto isect = _intersector->intersect(position, direction);
+    auto isect = _intersector->intersectLight(position, direction);
 
     while (isect.isLight()) {
         const auto lightId = isect.primId();
@@ -137,7 +196,7 @@ const float AreaLights::density(
                 / (lightArea(lightId) * cosTheta);
         }
 
-        isect = _intersector->intersect(isect.position(), direction);
+        isect = _intersector->intersectLight(isect.position(), direction);
     }
 
     return 0.0f;
@@ -164,7 +223,25 @@ LightSample AreaLights::sample(
     RandomEngine& engine,
     const vec3& position) const
 {
-    size_t lightId = _sampleLight(engine);
+    LightSample result = sampleUnoccluded(engine, position);
+    result._radiance *= _intersector->occluded(result.position(), position);
+    return result;
+}
+
+LightSample AreaLights::sampleUnoccluded(
+    RandomEngine& engine,
+    const vec3& position) const
+{
+    return sampleUnoccluded(engine, position, sampleUniform1(engine).value());
+}
+
+LightSample AreaLights::sampleUnoccluded(
+    RandomEngine& engine,
+    const vec3& position,
+    float uniform) const
+{
+    runtime_assert(numLights() != 0);
+    size_t lightId = _lightTable.sample(uniform);
 
     LightSample result;
     result._position = _samplePosition(lightId, engine);
@@ -175,9 +252,7 @@ LightSample AreaLights::sample(
 
     float cosTheta = dot(result.omega(), result.normal());
 
-    result._radiance *=
-        _intersector->occluded(result.position(), position) *
-        (cosTheta > 0.0f ? 1.0f : 0.0f);
+    result._radiance *= cosTheta > 0.0f ? 1.0f : 0.0f;
 
     return result;
 }
@@ -245,21 +320,15 @@ void AreaLights::updateBuffers(int* indices, vec4* vertices) const {
         indices[i] = i;
     }
 
-    const size_t numQuads = this->numLights();
-
-    for (size_t i = 0; i < numQuads; ++i) {
-        const vec3 up = _shapes[i].up * 0.5f;
-        const vec3 left = normalize(cross(up, _shapes[i].direction)) * 0.5f;
-        const vec3 position = _shapes[i].position;
-
-        vertices[i * 4 + 0] =
-            vec4(position - _sizes[i].x * left - _sizes[i].y * up, 1.0f);
-        vertices[i * 4 + 1] =
-            vec4(position + _sizes[i].x * left - _sizes[i].y * up, 1.0f);
-        vertices[i * 4 + 2] =
-            vec4(position + _sizes[i].x * left + _sizes[i].y * up, 1.0f);
-        vertices[i * 4 + 3] =
-            vec4(position - _sizes[i].x * left + _sizes[i].y * up, 1.0f);
+    // Embree treats quads with the last two indices equal as triangles.
+    for (size_t i = 0; i < numLights(); ++i) {
+        if (isTriangle(i)) {
+            indices[i * 4 + 3] = int(i * 4 + 2);
+        }
+    }
+
+    for (size_t i = 0; i < _corners.size(); ++i) {
+        vertices[i] = vec4(_corners[i], 1.0f);
     }
 }
 
@@ -275,26 +344,30 @@ void AreaLights::_updateSampler() {
         _weights[i] = power * totalPowerInv;
     }
 
-    lightSampler = PiecewiseSampler(
+    _lightTable = AliasTable(
         _weights.data(),
         _weights.data() + _weights.size());
 }
 
 const size_t AreaLights::_sampleLight(RandomEngine& engine) const {
     runtime_assert(numLights() != 0);
-
-    auto sample = lightSampler.sample();
-    return min(size_t(sample * numLights()), numLights() - 1);
+    return _lightTable.sample(sampleUniform1(engine).value());
 }
 
 const vec3 AreaLights::_samplePosition(size_t lightId, RandomEngine& engine) const {
-    auto uniform =
-        (sampleUniform2(engine).value() - vec2(0.5f)) * _sizes[lightId];
+    const vec3* corners = _corners.data() + lightId * 4;
 
-    const vec3 up = _shapes[lightId].up;
-    const vec3 left = normalize(cross(up, _shapes[lightId].direction));
+    if (isTriangle(lightId)) {
+        auto uv = sampleBarycentric1(engine);
+        return corners[0] * uv.w() + corners[1] * uv.u() + corners[2] * uv.v();
+    }
+    else {
+        auto uniform = sampleUniform2(engine);
 
-    return _shapes[lightId].position + uniform.x * left + uniform.y * up;
+        return corners[0]
+            + uniform.a() * (corners[1] - corners[0])
+            + uniform.b() * (corners[3] - corners[0]);
+    }
 }
 
 }
@@ -44,12 +44,14 @@ struct LightSampleEx {
     vec3 _omega;
     float _areaDensity;
     float _omegaDensity;
+    bool _distant = false; // environment, there is no distance falloff
 
     const vec3& position() const { return _position; }
     const vec3& normal() const { return _normal; }
     const vec3& gnormal() const { return _normal; }
     const vec3& radiance() const { return _radiance; }
     const vec3& omega() const { return _omega; } // outgoing from light
+    const bool distant() const { return _distant; }
     const float density() const { return _areaDensity * _omegaDensity; }
     const float densityInv() const { return 1.0f / density(); }
     const float areaDensity() const { return _areaDensity; };
@@ -78,7 +80,16 @@ public:
         const vec3& exitance,
         const vec2& size);
 
+    // Emits on the side of counter-clockwise winding.
+    const size_t addLight(
+        const string& name,
+        const vec3& v0,
+        const vec3& v1,
+        const vec3& v2,
+        const vec3& exitance);
+
     const size_t numLights() const;
+    const bool isTriangle(size_t lightId) const;
     const string& name(size_t lightId) const;
     const float lightArea(size_t lightId) const;
     const float lightPower(size_t lightId) const;
@@ -102,6 +113,17 @@ public:
         RandomEngine& engine,
         const vec3& position) const;
 
+    // Same as sample, but doesn't trace the shadow ray.
+    LightSample sampleUnoccluded(
+        RandomEngine& engine,
+        const vec3& position) const;
+
+    // Light is selected with the given uniform (for stratification).
+    LightSample sampleUnoccluded(
+        RandomEngine& engine,
+        const vec3& position,
+        float uniform) const;
+
     LightSampleEx sampleEx(
         RandomEngine& engine,
         const vec3& position) const;
@@ -120,7 +142,7 @@ public:
     void updateBuffers(int* indices, vec4* vertices) const override;
 public:
     const Intersector* _intersector = nullptr;
-    mutable PiecewiseSampler lightSampler;
+    AliasTable _lightTable;
 
     struct Shape {
         vec3 position;
@@ -128,14 +150,18 @@ public:
         vec3 up;
     };
 
-    vector<string> _names;
-    vector<Shape> _shapes;
-    vector<vec2> _sizes;
+    vector<string> _names; // one per light or emissive mesh
+    vector<uint32_t> _sources; // index to _names per light
+    vector<Shape> _shapes; // triangles: centroid, normal, first edge
+    vector<vec2> _sizes; // zero for triangles
     vector<vec3> _exitances;
+    vector<vec3> _corners; // four per light, the last two equal for triangles
+    vector<float> _areas;
     vector<float> _weights;
-    float _totalPower;
-    float _totalArea;
+    float _totalPower = 0.0f;
+    float _totalArea = 0.0f;
 
+    void _addSource(const string& name);
     void _updateSampler();
     const size_t _sampleLight(RandomEngine& engine) const;
     const vec3 _samplePosition(size_t lightId, RandomEngine& engine) const;
@@ -2,16 +2,15 @@
 
 namespace haste {
 
-BPT::BPT(size_t minSubpath, float roulette)
-    : _minSubpath(minSubpath)
-    , _roulette(roulette)
+BPT::BPT(size_t minSubpath, float roulette, float minSurvival)
+    : _roulette(minSubpath, roulette, minSurvival)
 { }
 
 string BPT::name() const {
     return "Bidirectional Path Tracing (Balance Heuristic)";
 }
 
-vec3 BPT::_trace(RandomEngine& engine, const Ray& ray) {
+vec3 BPT::_trace(RandomEngine& engine, const Ray& ray, float scale) {
     LightVertex light[_maxSubpath];
     size_t lSize = 0;
 
@@ -29,7 +28,7 @@ vec3 BPT::_trace(RandomEngine& engine, const Ray& ray) {
     }
 
     if (!isect.isPresent()) {
-        return radiance;
+        return radiance + _scene->queryEnvironment(ray.direction);
     }
 
     eye[itr].surface = _scene->querySurface(isect);
@@ -44,7 +43,7 @@ vec3 BPT::_trace(RandomEngine& engine, const Ray& ray) {
     radiance += _connect(engine, eye[itr], lSize, light);
     std::swap(itr, prv);
 
-    float roulette = eSize < _minSubpath ? 1.0f : _roulette;
+    float roulette = _roulette.expected(eye[prv].throughput, scale, eSize);
     float uniform = sampleUniform1(engine).value();
 
     while (uniform < roulette) {
@@ -78,7 +77,7 @@ vec3 BPT::_trace(RandomEngine& engine, const Ray& ray) {
         radiance += _connect(engine, eye[itr], lSize, light);
         std::swap(itr, prv);
 
-        roulette = eSize < _minSubpath ? 1.0f : _roulette;
+        roulette = _roulette.expected(eye[prv].throughput, scale, eSize);
         uniform = sampleUniform1(engine).value();
     }
 
@@ -99,6 +98,10 @@ void BPT::_trace(RandomEngine& engine, size_t& size, LightVertex* path) {
 
     auto edge = Edge(light, isect);
 
+    if (light.distant()) {
+        edge.setDistant();
+    }
+
     path[itr].surface = _scene->querySurface(isect);
     path[itr]._omega = -light.omega();
     path[itr].throughput = light.radiance() * edge.bCosTheta / light.density();
@@ -109,10 +112,11 @@ void BPT::_trace(RandomEngine& engine, size_t& size, LightVertex* path) {
     ++itr;
 
     size_t lSize = 2;
-    float roulette = lSize < _minSubpath ? 1.0f : _roulette;
+    float roulette = _roulette.expected(lSize);
     float uniform = sampleUniform1(engine).value();
 
-    while (uniform < roulette) {
+    // Vertices are written at most at lSize - 1, keep them in the buffer.
+    while (lSize < _maxSubpath && uniform < roulette) {
         auto bsdf = _scene->sampleBSDF(engine, path[prv].surface, path[prv].omega());
 
         isect = _scene->intersectMesh(path[prv].position(), bsdf.omega());
@@ -144,7 +148,7 @@ void BPT::_trace(RandomEngine& engine, size_t& size, LightVertex* path) {
         }
 
         ++lSize;
-        roulette = lSize < _minSubpath ? 1.0f : _roulette;
+        roulette = _roulette.expected(lSize);
         uniform = sampleUniform1(engine).value();
     }
 
@@ -198,6 +202,27 @@ vec3 BPT::_connect0(RandomEngine& engine, const EyeVertex& eye) {
         isect = _scene->intersect(isect.position(), bsdf.omega());
     }
 
+    if (!isect.isPresent()) {
+        auto lsdf = _scene->queryEnvironmentLSDF(bsdf.omega());
+        float bCosTheta = abs(dot(eye.gnormal(), bsdf.omega()));
+        float weightInv = 1.0f;
+
+        if (eye.specular * bsdf.specular() == 0.0f) {
+            // The environment is at infinity, only the cosine at the eye remains.
+            float c = 1.0f / bsdf.density();
+            float C = (eye.C * bsdf.densityRev() + eye.c) * bCosTheta * c;
+
+            weightInv += (C * lsdf.omegaDensity() + c) * lsdf.areaDensity();
+        }
+
+        radiance +=
+            lsdf.radiance() *
+            eye.throughput *
+            bsdf.throughput() *
+            bCosTheta /
+            (bsdf.density() * roulette * weightInv);
+    }
+
     return radiance;
 }
 
@@ -207,6 +232,10 @@ vec3 BPT::_connect1(RandomEngine& engine, const EyeVertex& eye) {
 
     auto edge = Edge(light, eye, light.omega());
 
+    if (light.distant()) {
+        edge.setDistant();
+    }
+
     float weightInv =
         bsdf.densityRev() * edge.bGeometry / light.areaDensity() +
         1.0f +
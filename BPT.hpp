@@ -6,7 +6,7 @@ namespace haste {
 
 class BPT : public Technique {
 public:
-    BPT(size_t minSubpath = 3, float roulette = 0.5f);
+    BPT(size_t minSubpath = 3, float roulette = 0.5f, float minSurvival = 0.1f);
 
     string name() const override;
 
@@ -37,10 +37,9 @@ private:
     };
 
     static const size_t _maxSubpath = 128;
-    const size_t _minSubpath;
-    const float _roulette;
+    const Roulette _roulette;
 
-    vec3 _trace(RandomEngine& engine, const Ray& ray) override;
+    vec3 _trace(RandomEngine& engine, const Ray& ray, float scale) override;
     void _trace(RandomEngine& engine, size_t& size, LightVertex* path);
     vec3 _connect0(RandomEngine& engine, const EyeVertex& eye);
     vec3 _connect1(RandomEngine& engine, const EyeVertex& eye);
@@ -0,0 +1,122 @@
+#include <runtime_assert>
+#include <Checkpoint.hpp>
+#include <cstring>
+
+namespace haste {
+
+//
+// Checkpoint layout, integers are uint64 in native byte order unless noted.
+//
+// header: magic "HSTP", uint32 version, width, height, uint32 features,
+//     numSamples, double elapsed
+// technique name, engine state, technique state
+// image: width * height vec4
+// features: albedo, normal (width * height vec4), moments (width * height float)
+//
+// Strings and arrays are written by BinaryWriter.
+//
+
+static const char checkpointMagic[4] = { 'H', 'S', 'T', 'P' };
+static const uint32_t checkpointVersion = 1;
+
+static void writeCheckpoint(
+    BinaryWriter& writer,
+    const Checkpoint& checkpoint,
+    const ImageView& view)
+{
+    const size_t size = view.width() * view.height();
+
+    writer.raw(checkpointMagic, 4);
+    writer.pod(checkpointVersion);
+    writer.pod(std::uint64_t(view.width()));
+    writer.pod(std::uint64_t(view.height()));
+    writer.pod(uint32_t(view.hasFeatures()));
+    writer.pod(std::uint64_t(checkpoint.numSamples));
+    writer.pod(checkpoint.elapsed);
+    writer.str(checkpoint.technique);
+    writer.str(checkpoint.engine);
+    writer.array(checkpoint.state);
+    writer.raw(view.data(), size * sizeof(vec4));
+
+    if (view.hasFeatures()) {
+        writer.raw(view._albedo, size * sizeof(vec4));
+        writer.raw(view._normal, size * sizeof(vec4));
+        writer.raw(view._moments, size * sizeof(float));
+    }
+}
+
+bool writeCheckpoint(const string& path, const Checkpoint& checkpoint, const ImageView& view) {
+    runtime_assert(view._yStorage == 0);
+    runtime_assert(!view.hasFeatures() || view._moments != nullptr);
+
+    // The first pass only measures the file.
+    BinaryWriter measure;
+    writeCheckpoint(measure, checkpoint, view);
+
+    return writeMappedFile(path, measure.size(), [&](char* data) {
+        BinaryWriter writer(data);
+        writeCheckpoint(writer, checkpoint, view);
+    });
+}
+
+bool readCheckpoint(Checkpoint& checkpoint, ImageView& view, const string& path) {
+    runtime_assert(view._yStorage == 0);
+
+    MappedFile file(path);
+
+    if (file.data() == nullptr) {
+        return false;
+    }
+
+    BinaryReader reader(file.data(), file.data() + file.size());
+
+    char magic[4];
+    reader.raw(magic, 4);
+
+    bool valid = std::memcmp(magic, checkpointMagic, 4) == 0
+        && reader.pod<uint32_t>() == checkpointVersion
+        && reader.pod<std::uint64_t>() == view.width()
+        && reader.pod<std::uint64_t>() == view.height()
+        && reader.pod<uint32_t>() == uint32_t(view.hasFeatures());
+
+    if (!valid) {
+        return false;
+    }
+
+    Checkpoint result;
+    result.numSamples = size_t(reader.pod<std::uint64_t>());
+    result.elapsed = reader.pod<double>();
+    result.technique = reader.str();
+    result.engine = reader.str();
+    reader.array(result.state);
+
+    const size_t size = view.width() * view.height();
+    const vec4* image = reader.skip<vec4>(size);
+    const vec4* albedo = nullptr;
+    const vec4* normal = nullptr;
+    const float* moments = nullptr;
+
+    if (view.hasFeatures()) {
+        albedo = reader.skip<vec4>(size);
+        normal = reader.skip<vec4>(size);
+        moments = reader.skip<float>(size);
+    }
+
+    if (!reader.good()) {
+        return false;
+    }
+
+    checkpoint = result;
+
+    std::memcpy(view.data(), image, size * sizeof(vec4));
+
+    if (view.hasFeatures()) {
+        std::memcpy(view._albedo, albedo, size * sizeof(vec4));
+        std::memcpy(view._normal, normal, size * sizeof(vec4));
+        std::memcpy(view._moments, moments, size * sizeof(float));
+    }
+
+    return true;
+}
+
+}
@@ -0,0 +1,25 @@
+#pragma once
+#include <ImageView.hpp>
+#include <utility.hpp>
+
+namespace haste {
+
+// What's needed besides the image to continue a batch render which has
+// been killed before it finished.
+struct Checkpoint {
+    string technique;
+    size_t numSamples = 0;
+    double elapsed = 0.0;
+    string engine; // RandomEngine::state()
+    vector<char> state; // Technique::saveState()
+};
+
+// The image and its feature buffers (if any) are stored raw, i.e. with the
+// accumulation weights.
+bool writeCheckpoint(const string& path, const Checkpoint& checkpoint, const ImageView& view);
+
+// Returns false if the checkpoint doesn't exist, is damaged or doesn't fit
+// the view (size, feature buffers). The view is left intact then.
+bool readCheckpoint(Checkpoint& checkpoint, ImageView& view, const string& path);
+
+}
@@ -0,0 +1,171 @@
+#include <runtime_assert>
+#include <Denoiser.hpp>
+
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range2d.h>
+
+namespace haste {
+
+static const size_t denoiseTile = 64;
+static const float colorSigma = 4.0f;
+static const float normalExponent = 128.0f;
+static const float depthSigma = 0.05f; // relative to the depth, per unit step
+static const float albedoEpsilon = 0.001f;
+static const float kernel[3] = { 3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f };
+
+static float intensity(const vec3& color) {
+    return (color.x + color.y + color.z) / 3.0f;
+}
+
+// Calls func(x, y) for every pixel, in parallel over square tiles.
+template <class F> void forEachTile(size_t width, size_t height, const F& func) {
+    tbb::parallel_for(
+        tbb::blocked_range2d<size_t>(0, height, denoiseTile, 0, width, denoiseTile),
+        [&](const tbb::blocked_range2d<size_t>& range) {
+            for (size_t y = range.rows().begin(); y < range.rows().end(); ++y) {
+                for (size_t x = range.cols().begin(); x < range.cols().end(); ++x) {
+                    func(x, y);
+                }
+            }
+        });
+}
+
+void denoiseStep(
+    vector<DenoisePixel>& dst,
+    const vector<DenoisePixel>& src,
+    const vector<DenoiseGuide>& guides,
+    size_t width,
+    size_t height,
+    int step)
+{
+    forEachTile(width, height, [&](size_t x, size_t y) {
+        const size_t index = y * width + x;
+        const DenoiseGuide& guide = guides[index];
+        const DenoisePixel& center = src[index];
+
+        const float centerIntensity = intensity(center.irradiance);
+        const float colorScale = 1.0f / (colorSigma * sqrt(center.variance) + 1e-4f);
+        const float depthScale = 1.0f / (depthSigma * float(step) * guide.depth + 1e-4f);
+
+        vec3 irradiance = vec3(0.0f);
+        float variance = 0.0f;
+        float weights = 0.0f;
+
+        for (int dy = -2; dy <= 2; ++dy) {
+            const int qy = int(y) + dy * step;
+
+            if (qy < 0 || qy >= int(height)) {
+                continue;
+            }
+
+            for (int dx = -2; dx <= 2; ++dx) {
+                const int qx = int(x) + dx * step;
+
+                if (qx < 0 || qx >= int(width)) {
+                    continue;
+                }
+
+                const size_t q = size_t(qy) * width + size_t(qx);
+                const DenoiseGuide& that = guides[q];
+
+                if (!that.sampled || that.valid != guide.valid) {
+                    continue;
+                }
+
+                float weight = kernel[abs(dx)] * kernel[abs(dy)];
+
+                weight *= exp(-abs(intensity(src[q].irradiance) - centerIntensity) * colorScale);
+
+                if (guide.valid) {
+                    weight *= pow(max(dot(guide.normal, that.normal), 0.0f), normalExponent);
+                    weight *= exp(-abs(guide.depth - that.depth) * depthScale);
+                }
+
+                irradiance += src[q].irradiance * weight;
+                variance += src[q].variance * weight * weight;
+                weights += weight;
+            }
+        }
+
+        if (weights > 0.0f) {
+            dst[index].irradiance = irradiance / weights;
+            dst[index].variance = variance / (weights * weights);
+        }
+        else {
+            dst[index] = center;
+        }
+    });
+}
+
+void denoise(vec4* dst, const ImageView& view, size_t numIterations) {
+    Denoiser().denoise(dst, view, numIterations);
+}
+
+Denoiser::Denoiser() { }
+
+Denoiser::~Denoiser() { }
+
+void Denoiser::denoise(vec4* dst, const ImageView& view, size_t numIterations) {
+    runtime_assert(view.hasFeatures() && view._moments != nullptr);
+    runtime_assert(view._yStorage == 0);
+
+    const size_t width = view.width();
+    const size_t height = view.height();
+    const size_t size = width * height;
+
+    _pixels.resize(size);
+    _scratch.resize(size);
+    _guides.resize(size);
+
+    vector<DenoisePixel>& pixels = _pixels;
+    vector<DenoisePixel>& scratch = _scratch;
+    vector<DenoiseGuide>& guides = _guides;
+
+    parallelChunks(size, [&](size_t i) {
+        const vec4& radiance = view._data[i];
+        const vec4& albedo = view._albedo[i];
+        const vec4& normal = view._normal[i];
+
+        DenoiseGuide& guide = guides[i];
+        guide = DenoiseGuide();
+
+        if (radiance.w == 0.0f) {
+            pixels[i] = DenoisePixel();
+            return;
+        }
+
+        guide.sampled = true;
+
+        const vec3 mean = radiance.xyz() / radiance.w;
+
+        if (albedo.w != 0.0f && dot(normal.xyz(), normal.xyz()) > 0.0f) {
+            guide.albedo = max(albedo.xyz() / albedo.w, vec3(albedoEpsilon));
+            guide.normal = normalize(normal.xyz());
+            guide.depth = normal.w / albedo.w;
+            guide.valid = true;
+        }
+
+        // Variance of the mean of the samples, demodulated like the colour.
+        const float meanIntensity = intensity(mean);
+        const float secondMoment = view._moments[i] / radiance.w;
+        const float albedoIntensity = intensity(guide.albedo);
+
+        pixels[i].irradiance = mean / guide.albedo;
+        pixels[i].variance =
+            max(secondMoment - meanIntensity * meanIntensity, 0.0f) /
+            (radiance.w * albedoIntensity * albedoIntensity);
+    });
+
+    for (size_t i = 0; i < numIterations; ++i) {
+        denoiseStep(scratch, pixels, guides, width, height, 1 << i);
+        std::swap(pixels, scratch);
+    }
+
+    parallelChunks(size, [&](size_t i) {
+        dst[i] = view._data[i].w == 0.0f
+            ? vec4(0.0f)
+            : vec4(pixels[i].irradiance * guides[i].albedo, 1.0f);
+    });
+}
+
+}
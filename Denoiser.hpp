@@ -0,0 +1,44 @@
+#pragma once
+#include <ImageView.hpp>
+#include <utility.hpp>
+
+namespace haste {
+
+// Edge-avoiding a-trous wavelet filter (Dammertz et al. 2010) guided by the
+// albedo, normal and depth features. The colour weights are scaled by the
+// variance of the pixel means, which is filtered along (Schied et al. 2017).
+// The irradiance (colour over albedo) is filtered, so textures stay sharp.
+//
+// The view needs the feature buffers and the moments, dst gets the filtered
+// image with weights of one. Runs in parallel over tiles.
+void denoise(vec4* dst, const ImageView& view, size_t numIterations = 5);
+
+struct DenoisePixel {
+    vec3 irradiance = vec3(0.0f);
+    float variance = 0.0f;
+};
+
+struct DenoiseGuide {
+    vec3 albedo = vec3(1.0f); // one where nothing was hit
+    vec3 normal = vec3(0.0f);
+    float depth = 0.0f;
+    bool sampled = false;
+    bool valid = false; // has the features of a surface
+};
+
+// The same filter, but the intermediate buffers are kept between calls, so
+// denoising repeatedly at the same size doesn't allocate.
+class Denoiser {
+public:
+    Denoiser();
+    ~Denoiser();
+
+    void denoise(vec4* dst, const ImageView& view, size_t numIterations = 5);
+
+private:
+    vector<DenoisePixel> _pixels;
+    vector<DenoisePixel> _scratch;
+    vector<DenoiseGuide> _guides;
+};
+
+}
@@ -1,5 +1,4 @@
 #include <sstream>
-#include <GLFW/glfw3.h>
 #include <DirectIllumination.hpp>
 
 namespace haste {
@@ -11,7 +10,7 @@ void DirectIllumination::render(
    RandomEngine& engine,
    size_t cameraId)
 {
-    auto trace = [&](RandomEngine& engine, Ray ray) -> vec3 {
+    auto trace = [&](RandomEngine& engine, Ray ray, float) -> vec3 {
         return this->trace(engine, ray);
     };
 
@@ -34,26 +33,18 @@ vec3 DirectIllumination::trace(RandomEngine& engine, Ray ray) {
         isect = _scene->intersect(ray);
     }
 
-    if (isect.isPresent()) {
-        auto reflected = -ray.direction;
-        auto surface = _scene->querySurface(isect);
-        auto sample = _scene->queryBSDF(isect).sample(
-            engine,
-            surface,
-            reflected);
+    if (!isect.isPresent()) {
+        return radiance + _scene->queryEnvironment(ray.direction);
+    }
 
-        ray.origin = isect.position();
-        ray.direction = sample.omega();
+    auto& bsdf = _scene->queryBSDF(isect);
+    auto surface = _scene->querySurface(isect);
 
-        isect = _scene->intersect(ray);
-
-        if (isect.isLight()) {
-            radiance += _scene->queryRadiance(isect)
-                * sample.throughput()
-                * dot(normalize(surface.normal()), sample.omega())
-                / sample.density();
-        }
-    }
+    radiance += _scene->sampleDirectLightMixed(
+        engine,
+        surface,
+        -ray.direction,
+        bsdf);
 
     return radiance;
 }
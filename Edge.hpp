@@ -23,6 +23,14 @@ struct Edge
         bGeometry = distSqInv * bCosTheta;
     }
 
+    // Edges to the environment don't fall off with distance.
+    void setDistant()
+    {
+        distSqInv = 1.0f;
+        fGeometry = fCosTheta;
+        bGeometry = bCosTheta;
+    }
+
     float distSqInv;
     float fCosTheta;
     float bCosTheta;
@@ -0,0 +1,108 @@
+#include <runtime_assert>
+#include <EnvironmentLight.hpp>
+
+namespace haste {
+
+EnvironmentLight::EnvironmentLight() { }
+
+EnvironmentLight::EnvironmentLight(const string& path) {
+    loadEXR(path, _width, _height, _texels);
+
+    const size_t numTexels = _width * _height;
+    const float texelAngle = 2.0f * pi<float>() * pi<float>() / float(numTexels);
+
+    vector<float> weights(numTexels);
+
+    for (size_t y = 0; y < _height; ++y) {
+        const float theta = pi<float>() * (float(_height - y - 1) + 0.5f) / float(_height);
+        const float sinTheta = sin(theta);
+
+        for (size_t x = 0; x < _width; ++x) {
+            const vec3& texel = _texels[y * _width + x];
+            weights[y * _width + x] = (texel.x + texel.y + texel.z) * sinTheta;
+        }
+    }
+
+    double total = 0.0;
+
+    for (size_t i = 0; i < numTexels; ++i) {
+        total += weights[i];
+    }
+
+    if (total <= 0.0) {
+        _texels.clear();
+        _width = _height = 0;
+        return;
+    }
+
+    _probabilities.resize(numTexels);
+
+    for (size_t i = 0; i < numTexels; ++i) {
+        _probabilities[i] = float(weights[i] / total);
+    }
+
+    _table = AliasTable(weights.data(), weights.data() + weights.size());
+    _totalRadiance = float(total) * texelAngle;
+}
+
+const bool EnvironmentLight::empty() const {
+    return _texels.empty();
+}
+
+const vec3 EnvironmentLight::queryRadiance(const vec3& omega) const {
+    return empty() ? vec3(0.0f) : _texels[_texel(omega)];
+}
+
+const float EnvironmentLight::density(const vec3& omega) const {
+    if (empty()) {
+        return 0.0f;
+    }
+
+    const float cosTheta = clamp(omega.y, -1.0f, 1.0f);
+    return _density(_texel(omega), sqrt(1.0f - cosTheta * cosTheta));
+}
+
+EnvironmentSample EnvironmentLight::sample(RandomEngine& engine) const {
+    runtime_assert(!empty());
+
+    const size_t texel = _table.sample(sampleUniform1(engine).value());
+    const size_t x = texel % _width;
+    const size_t y = texel / _width;
+
+    const vec2 uniform = sampleUniform2(engine).value();
+    const float phi = 2.0f * pi<float>() * (float(x) + uniform.x) / float(_width) - pi<float>();
+    const float theta = pi<float>() * (float(_height - y - 1) + uniform.y) / float(_height);
+    const float sinTheta = sin(theta);
+
+    EnvironmentSample result;
+    result._omega = vec3(sinTheta * cos(phi), cos(theta), sinTheta * sin(phi));
+    result._radiance = _texels[texel];
+    result._density = _density(texel, sinTheta);
+
+    return result;
+}
+
+const float EnvironmentLight::totalRadiance() const {
+    return _totalRadiance;
+}
+
+const size_t EnvironmentLight::_texel(const vec3& omega) const {
+    const float theta = acos(clamp(omega.y, -1.0f, 1.0f));
+    const float phi = atan2(omega.z, omega.x) + pi<float>();
+
+    const size_t x = min(size_t(phi * 0.5f * one_over_pi<float>() * _width), _width - 1);
+    const size_t row = min(size_t(theta * one_over_pi<float>() * _height), _height - 1);
+
+    return (_height - row - 1) * _width + x;
+}
+
+const float EnvironmentLight::_density(size_t texel, float sinTheta) const {
+    if (sinTheta <= 0.0f) {
+        return 0.0f;
+    }
+
+    const float numTexels = float(_width * _height);
+    return _probabilities[texel] * numTexels / (2.0f * pi<float>() * pi<float>() * sinTheta);
+}
+
+}
@@ -0,0 +1,48 @@
+#pragma once
+#include <Prerequisites.hpp>
+#include <utility.hpp>
+#include <Sample.hpp>
+
+namespace haste {
+
+struct EnvironmentSample {
+    vec3 _omega; // towards the environment
+    vec3 _radiance;
+    float _density; // with respect to solid angle
+
+    const vec3& omega() const { return _omega; }
+    const vec3& radiance() const { return _radiance; }
+    const float density() const { return _density; }
+};
+
+// Infinitely distant light given by a latitude-longitude map (y is up).
+// Texels are importance sampled with an alias table, proportionally to
+// their radiance times solid angle.
+class EnvironmentLight {
+public:
+    EnvironmentLight();
+    EnvironmentLight(const string& path);
+
+    const bool empty() const;
+
+    const vec3 queryRadiance(const vec3& omega) const;
+    const float density(const vec3& omega) const;
+
+    EnvironmentSample sample(RandomEngine& engine) const;
+
+    // Integral of r + g + b over the sphere.
+    const float totalRadiance() const;
+
+private:
+    size_t _width = 0;
+    size_t _height = 0;
+    vector<vec3> _texels; // bottom row first (as loaded by loadEXR)
+    vector<float> _probabilities;
+    AliasTable _table;
+    float _totalRadiance = 0.0f;
+
+    const size_t _texel(const vec3& omega) const;
+    const float _density(size_t texel, float sinTheta) const;
+};
+
+}
@@ -13,37 +13,75 @@ ImageView::ImageView(vec4* data, size_t width, size_t height)
     , _yWindow(height) {
 }
 
+ImageView::ImageView(vec4* data, size_t width, size_t height, size_t yBegin, size_t yEnd)
+    : _data(data)
+    , _yStorage(yBegin)
+    , _width(width)
+    , _height(height)
+    , _xOffset(0)
+    , _yOffset(yBegin)
+    , _xWindow(width)
+    , _yWindow(yEnd - yBegin) {
+}
+
 vec4& ImageView::relAt(size_t x, size_t y) {
-    return _data[(y + _yOffset) * _width + x + _xOffset];
+    return _data[(y + _yOffset - _yStorage) * _width + x + _xOffset];
 }
 
 vec4& ImageView::absAt(size_t x, size_t y) {
-    return _data[y * _width + x];
+    return _data[(y - _yStorage) * _width + x];
 }
 
 const vec4& ImageView::relAt(size_t x, size_t y) const {
-    return _data[(y + _yOffset) * _width + x + _xOffset];
+    return _data[(y + _yOffset - _yStorage) * _width + x + _xOffset];
 }
 
 const vec4& ImageView::absAt(size_t x, size_t y) const {
-    return _data[y * _width + x];
+    return _data[(y - _yStorage) * _width + x];
 }
 
 const vec4& ImageView::last() const {
-    return _data[(_yWindow + _yOffset - 1) * _width + _xWindow + _xOffset - 1];
+    return _data[(_yWindow + _yOffset - _yStorage - 1) * _width + _xWindow + _xOffset - 1];
+}
+
+vec4& ImageView::albedoAt(size_t x, size_t y) {
+    return _albedo[(y - _yStorage) * _width + x];
+}
+
+vec4& ImageView::normalAt(size_t x, size_t y) {
+    return _normal[(y - _yStorage) * _width + x];
+}
+
+float& ImageView::momentsAt(size_t x, size_t y) {
+    return _moments[(y - _yStorage) * _width + x];
 }
 
 void ImageView::clear() {
-    if (_xOffset == 0 && _yOffset == 0 &&
-        _xWindow == _width && _yWindow == _height) {
-        std::memset(_data, 0, _width * _height * sizeof(vec4));
+    auto clear = [&](vec4* data) {
+        if (_xOffset == 0 && _yOffset == 0 && _yStorage == 0 &&
+            _xWindow == _width && _yWindow == _height) {
+            std::memset(data, 0, _width * _height * sizeof(vec4));
+        }
+        else {
+            size_t yBegin = _yOffset;
+            size_t yEnd = _yOffset + _yWindow;
+
+            for (size_t y = yBegin; y < yEnd; ++y) {
+                std::memset(data + (y - _yStorage) * _width + _xOffset, 0, _xWindow * sizeof(vec4));
+            }
+        }
+    };
+
+    clear(_data);
+
+    if (hasFeatures()) {
+        clear(_albedo);
+        clear(_normal);
     }
-    else {
-        size_t yBegin = _yOffset;
-        size_t yEnd = _yOffset + _yWindow;
 
-        for (size_t y = yBegin; y < yEnd; ++y) {
-            std::memset(_data + y * _width + _xOffset, 0, _xWindow * sizeof(vec4));
+    if (_moments != nullptr) {
+        for (size_t y = _yOffset; y < _yOffset + _yWindow; ++y) {
+            std::memset(_moments + (y - _yStorage) * _width + _xOffset, 0, _xWindow * sizeof(float));
         }
     }
 }
@@ -7,7 +7,18 @@ struct ImageView {
     ImageView() = default;
     ImageView(vec4* data, size_t width, size_t height);
 
+    // View of the rows [yBegin, yEnd) of a larger image, data holds only
+    // these rows (e.g. a band of tiles of an out-of-core render).
+    ImageView(vec4* data, size_t width, size_t height, size_t yBegin, size_t yEnd);
+
     vec4* _data = nullptr;
+    size_t _yStorage = 0; // the first row held by _data
+
+    // Optional feature buffers (AOVs) laid out like _data, albedo.w counts
+    // the feature samples and normal.w accumulates the depth.
+    vec4* _albedo = nullptr;
+    vec4* _normal = nullptr;
+    float* _moments = nullptr; // sums of squared intensities of the samples
     size_t _width = 0;
     size_t _height = 0;
     size_t _xOffset = 0;
@@ -36,6 +47,12 @@ struct ImageView {
     const vec4& relAt(size_t x, size_t y) const;
     const vec4& absAt(size_t x, size_t y) const;
     const vec4& last() const;
+
+    const bool hasFeatures() const { return _albedo != nullptr; }
+    vec4& albedoAt(size_t x, size_t y);
+    vec4& normalAt(size_t x, size_t y);
+    float& momentsAt(size_t x, size_t y);
+
     vec4* data() { return _data; }
     const vec4* data() const { return _data; }
     void clear();
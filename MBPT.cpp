@@ -4,9 +4,8 @@
 
 namespace haste {
 
-MBPT::MBPT(size_t minSubpath, float roulette, float beta)
-    : _minSubpath(minSubpath)
-    , _roulette(roulette)
+MBPT::MBPT(size_t minSubpath, float roulette, float minSurvival, float beta)
+    : _roulette(minSubpath, roulette, minSurvival)
     , _beta(beta)
 { }
 
@@ -15,8 +14,8 @@ void MBPT::render(
     RandomEngine& engine,
     size_t cameraId)
 {
-    auto trace = [&](RandomEngine& engine, Ray ray) -> vec3 {
-        return _trace(engine, ray);
+    auto trace = [&](RandomEngine& engine, Ray ray, float scale) -> vec3 {
+        return _trace(engine, ray, scale);
     };
 
     for_each_ray(view, engine, _scene->cameras(), cameraId, trace);
@@ -40,7 +39,8 @@ void MBPT::_trace(RandomEngine& engine, size_t& size, LightVertex* path) {
         return;
     }
 
-    float distSqInv = 1.0f / distance2(light.position(), isect.position());
+    // The environment is at infinity, its edges don't fall off.
+    float distSqInv = light.distant() ? 1.0f : 1.0f / distance2(light.position(), isect.position());
     float fCosTheta = abs(dot(light.omega(), isect.gnormal()));
     float bCosTheta = abs(dot(light.omega(), light.normal()));
     float fgeometry = distSqInv * fCosTheta;
@@ -56,10 +56,11 @@ void MBPT::_trace(RandomEngine& engine, size_t& size, LightVertex* path) {
     ++itr;
 
     size_t lSize = 2;
-    float roulette = lSize < _minSubpath ? 1.0f : _roulette;
+    float roulette = _roulette.expected(lSize);
     float uniform = sampleUniform1(engine).value();
 
-    while (uniform < roulette) {
+    // Vertices are written at most at lSize - 1, keep them in the buffer.
+    while (lSize < _maxSubpath && uniform < roulette) {
         auto bsdf = _scene->sampleBSDF(engine, path[prv].surface, path[prv].omega);
 
         isect = _scene->intersectMesh(path[prv].position(), bsdf.omega());
@@ -99,7 +100,7 @@ void MBPT::_trace(RandomEngine& engine, size_t& size, LightVertex* path) {
         }
 
         ++lSize;
-        roulette = lSize < _minSubpath ? 1.0f : _roulette;
+        roulette = _roulette.expected(lSize);
         uniform = sampleUniform1(engine).value();
     }
 
@@ -113,7 +114,7 @@ void MBPT::_trace(RandomEngine& engine, size_t& size, LightVertex* path) {
     }
 }
 
-vec3 MBPT::_trace(RandomEngine& engine, const Ray& ray) {
+vec3 MBPT::_trace(RandomEngine& engine, const Ray& ray, float scale) {
     LightVertex light[_maxSubpath];
     size_t lSize = 0;
 
@@ -131,7 +132,7 @@ vec3 MBPT::_trace(RandomEngine& engine, const Ray& ray) {
     }
 
     if (!isect.isPresent()) {
-        return radiance;
+        return radiance + _scene->queryEnvironment(ray.direction);
     }
 
     float distSqInv, fgeometry, bgeometry, fCosTheta, bCosTheta;
@@ -152,7 +153,7 @@ vec3 MBPT::_trace(RandomEngine& engine, const Ray& ray) {
     std::swap(itr, prv);
 
     size_t eSize = 2;
-    float roulette = eSize < _minSubpath ? 1.0f : _roulette;
+    float roulette = _roulette.expected(eye[prv].throughput, scale, eSize);
     float uniform = sampleUniform1(engine).value();
 
     while (uniform < roulette) {
@@ -190,7 +191,7 @@ vec3 MBPT::_trace(RandomEngine& engine, const Ray& ray) {
         radiance += _connect(engine, eye[itr], lSize, light);
         std::swap(itr, prv);
 
-        roulette = eSize < _minSubpath ? 1.0f : _roulette;
+        roulette = _roulette.expected(eye[prv].throughput, scale, eSize);
         uniform = sampleUniform1(engine).value();
     }
 
@@ -241,6 +242,27 @@ vec3 MBPT::_connect0(RandomEngine& engine, const EyeVertex& eye) {
         isect = _scene->intersect(isect.position(), bsdf.omega());
     }
 
+    if (!isect.isPresent()) {
+        auto lsdf = _scene->queryEnvironmentLSDF(bsdf.omega());
+        float bCosTheta = abs(dot(eye.gnormal(), bsdf.omega()));
+        float weightInv = 1.0f;
+
+        if (eye.specular * bsdf.specular() == 0.0f) {
+            // The environment is at infinity, only the cosine at the eye remains.
+            float c = 1.0f / _pow(bsdf.density());
+            float C = (eye.C * _pow(bsdf.densityRev()) + eye.c) * _pow(bCosTheta) * c;
+
+            weightInv += (C * _pow(lsdf.omegaDensity()) + c) * _pow(lsdf.areaDensity());
+        }
+
+        radiance +=
+            lsdf.radiance() *
+            eye.throughput *
+            bsdf.throughput() *
+            bCosTheta /
+            (bsdf.density() * roulette * weightInv);
+    }
+
     return radiance;
 }
 
@@ -248,7 +270,7 @@ vec3 MBPT::_connect1(RandomEngine& engine, const EyeVertex& eye) {
     LightSampleEx light = _scene->sampleLightEx(engine, eye.position());
     auto bsdf = _scene->queryBSDFEx(eye.surface, -light.omega(), eye.omega);
 
-    float distSqInv = 1.0f / distance2(eye.position(), light.position());
+    float distSqInv = light.distant() ? 1.0f : 1.0f / distance2(eye.position(), light.position());
     float eCosTheta = abs(dot(light.omega(), eye.gnormal()));
     float lCosTheta = abs(dot(light.omega(), light.normal()));
 
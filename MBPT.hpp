@@ -6,7 +6,11 @@ namespace haste {
 
 class MBPT : public Technique {
 public:
-    MBPT(size_t minSubpath = 3, float roulette = 0.5f, float beta = 0.0f);
+    MBPT(
+        size_t minSubpath = 3,
+        float roulette = 0.5f,
+        float minSurvival = 0.1f,
+        float beta = 0.0f);
 
     void render(
         ImageView& view,
@@ -39,8 +43,7 @@ private:
     };
 
     static const size_t _maxSubpath = 1024;
-    const size_t _minSubpath;
-    const float _roulette;
+    const Roulette _roulette;
     const float _beta;
 
     float _pow(float x) const {
@@ -48,7 +51,7 @@ private:
     }
 
     void _trace(RandomEngine& engine, size_t& size, LightVertex* path);
-    vec3 _trace(RandomEngine& engine, const Ray& ray);
+    vec3 _trace(RandomEngine& engine, const Ray& ray, float scale);
     vec3 _connect0(RandomEngine& engine, const EyeVertex& eye);
     vec3 _connect1(RandomEngine& engine, const EyeVertex& eye);
     vec3 _connect(const EyeVertex& eye, const LightVertex& light);
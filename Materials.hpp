@@ -25,6 +25,7 @@ public:
     vector<vec3> diffuses;
     vector<vec3> emissives;
     vector<vec3> speculars;
+    vector<float> iors; // of transmissive BSDFs, compared on reload
     vector<unique<BSDF>> bsdfs;
 
     size_t numMaterials() const {
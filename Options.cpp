@@ -5,9 +5,11 @@
 #include <loader.hpp>
 
 #include <BPT.hpp>
+#include <DirectIllumination.hpp>
 #include <MBPT.hpp>
 #include <PathTracing.hpp>
 #include <PhotonMapping.hpp>
+#include <ReSTIR.hpp>
 #include <VCM.hpp>
 
 namespace haste {
@@ -30,20 +32,38 @@ R"(
       --PT                  Use path tracing for rendering (this is default one).
       --PM                  Use photon mapping for rendering.
       --VCM                 Use vertex connection and merging (not implemented/wip).
+      --ReSTIR              Use direct illumination with reservoir resampling of lights.
+      --DI                  Use direct illumination only (single bounce, light and BSDF sampling).
       --num-photons=<n>     Use n photons. [default: 1 000 000]
       --num-gather=<n>      Use n as maximal number of gathered photons. [default: 100]
       --max-radius=<n>      Use n as maximum gather radius. [default: 0.1]
       --min-subpath=<n>     Do not use Russian roulette for sub-paths shorter than n. [default: 5]
       --roulette=<n>        Russian roulette coefficient. [default: 0.5]
+      --min-survival=<n>    Minimal survival probability of Russian roulette. [default: 0.1]
+      --splitting           Split paths with high expected contribution (PT only).
+      --nee-samples=<n>     Take n light samples per path vertex (PT only). [default: 1]
+      --num-candidates=<n>  Resample n light candidates per pixel (ReSTIR only). [default: 32]
+      --spatial-reuse       Reuse reservoirs of neighbouring pixels (ReSTIR only).
+      --temporal-reuse      Reuse reservoirs of the previous pass (ReSTIR, interactive mode only).
       --batch               Run in batch mode (interactive otherwise).
+      --preview             Start with low resolution direct illumination after reloads (interactive only).
       --no-reload           Disable autoreload (input file is reloaded on modification in interactive mode).
+      --compress-meshes     Store mesh normals and tangents compressed (less memory, slower shading).
+      --scene-cache         Load the scene from a binary cache next to the input, write it if missing or stale.
       --num-samples=<n>     Terminate after n samples.
       --num-seconds=<n>     Terminate after n seconds.
       --num-minutes=<n>     Terminate after n minutes.
       --parallel            Use multithreading.
       --snapshot=<n>        Save output every n samples (adds number of samples to output file).
+      --half-float          Store output and snapshots as 16 bit floats.
+      --denoise             Denoise the result (saved aside in batch mode, displayed in interactive mode), implies --aovs.
+      --aovs                Add albedo, normal and depth layers of the first non-specular hit to the output.
+      --checkpoint=<n>      Save the accumulation state every n seconds (batch only).
+      --resume              Continue from the checkpoint of a killed render (batch only).
+      --tile-size=<n>       Render n x n tiles one row at a time, streamed to a tiled EXR (batch only, needs --num-samples).
       --output=<path>       Output file. <input>.<width>.<height>.<samples>.<technique>.exr if not specified.
       --reference=<path>    Reference file for comparison.
+      --environment=<path>  Light the scene with a latitude-longitude EXR environment map.
       --camera=<id>         Use camera with given id. [default: 0]
       --resolution=<WxH>    Resolution of output image. [default: 800x600]
 
@@ -197,7 +217,9 @@ Options parseArgs(int argc, char const* const* argv) {
             dict.count("--BPT") +
             dict.count("--PT") +
             dict.count("--PM") +
-            dict.count("--VCM");
+            dict.count("--VCM") +
+            dict.count("--ReSTIR") +
+            dict.count("--DI");
 
         if (numTechniqes > 1) {
             options.displayHelp = true;
@@ -220,6 +242,14 @@ Options parseArgs(int argc, char const* const* argv) {
             options.technique = Options::VCM;
             dict.erase("--VCM");
         }
+        else if (dict.count("--ReSTIR")) {
+            options.technique = Options::ReSTIR;
+            dict.erase("--ReSTIR");
+        }
+        else if (dict.count("--DI")) {
+            options.technique = Options::DI;
+            dict.erase("--DI");
+        }
 
         if (dict.count("--num-photons")) {
             if (options.technique != Options::PM &&
@@ -338,16 +368,139 @@ Options parseArgs(int argc, char const* const* argv) {
             }
         }
 
+        if (dict.count("--min-survival")) {
+            if (options.technique != Options::BPT &&
+                options.technique != Options::PT &&
+                options.technique != Options::VCM) {
+                options.displayHelp = true;
+                options.displayMessage = "--min-survival in not available for specified technique.";
+                return options;
+            }
+            else if (!isReal(dict["--min-survival"])) {
+                options.displayHelp = true;
+                options.displayMessage = "Invalid value for --min-survival.";
+                return options;
+            }
+            else {
+                options.minSurvival = atof(dict["--min-survival"].c_str());
+
+                if (options.minSurvival <= 0.0 || 1.0 < options.minSurvival)
+                {
+                    options.displayHelp = true;
+                    options.displayMessage = "A value for --min-survival must be in range (0, 1].";
+                }
+
+                dict.erase("--min-survival");
+            }
+        }
+
+        // Headless builds have no window, they always run in batch mode.
+#ifdef HASTE_HEADLESS
+        options.batch = true;
+#endif
+
         if (dict.count("--batch")) {
             options.batch = true;
             dict.erase("--batch");
         }
 
+        if (dict.count("--splitting")) {
+            if (options.technique != Options::PT) {
+                options.displayHelp = true;
+                options.displayMessage = "--splitting can be specified for PT only.";
+                return options;
+            }
+            else {
+                options.splitting = true;
+                dict.erase("--splitting");
+            }
+        }
+
+        if (dict.count("--nee-samples")) {
+            if (options.technique != Options::PT) {
+                options.displayHelp = true;
+                options.displayMessage = "--nee-samples can be specified for PT only.";
+                return options;
+            }
+            else if (!isUnsigned(dict["--nee-samples"]) || atoi(dict["--nee-samples"].c_str()) == 0) {
+                options.displayHelp = true;
+                options.displayMessage = "Invalid value for --nee-samples.";
+                return options;
+            }
+            else {
+                options.numLightSamples = atoi(dict["--nee-samples"].c_str());
+                dict.erase("--nee-samples");
+            }
+        }
+
+        if (dict.count("--num-candidates")) {
+            if (options.technique != Options::ReSTIR) {
+                options.displayHelp = true;
+                options.displayMessage = "--num-candidates can be specified for ReSTIR only.";
+                return options;
+            }
+            else if (!isUnsigned(dict["--num-candidates"]) || atoi(dict["--num-candidates"].c_str()) == 0) {
+                options.displayHelp = true;
+                options.displayMessage = "Invalid value for --num-candidates.";
+                return options;
+            }
+            else {
+                options.numCandidates = atoi(dict["--num-candidates"].c_str());
+                dict.erase("--num-candidates");
+            }
+        }
+
+        if (dict.count("--spatial-reuse")) {
+            if (options.technique != Options::ReSTIR) {
+                options.displayHelp = true;
+                options.displayMessage = "--spatial-reuse can be specified for ReSTIR only.";
+                return options;
+            }
+            else {
+                options.spatialReuse = true;
+                dict.erase("--spatial-reuse");
+            }
+        }
+
+        if (dict.count("--temporal-reuse")) {
+            if (options.technique != Options::ReSTIR || options.batch) {
+                options.displayHelp = true;
+                options.displayMessage = "--temporal-reuse can be specified for ReSTIR in interactive mode only.";
+                return options;
+            }
+            else {
+                options.temporalReuse = true;
+                dict.erase("--temporal-reuse");
+            }
+        }
+
+        if (dict.count("--preview")) {
+            if (options.batch) {
+                options.displayHelp = true;
+                options.displayMessage = "--preview can be specified in interactive mode only.";
+                return options;
+            }
+            else {
+                options.preview = true;
+                dict.erase("--preview");
+            }
+        }
+
         if (dict.count("--no-reload")) {
             options.reload = false;
             dict.erase("--no-reload");
         }
 
+        if (dict.count("--compress-meshes")) {
+            options.compressMeshes = true;
+            dict.erase("--compress-meshes");
+        }
+
+        if (dict.count("--scene-cache")) {
+            options.sceneCache = true;
+            dict.erase("--scene-cache");
+        }
+
         if (dict.count("--num-samples")) {
             if (!isUnsigned(dict["--num-samples"])) {
                 options.displayHelp = true;
@@ -405,6 +558,22 @@ Options parseArgs(int argc, char const* const* argv) {
             }
         }
 
+        if (dict.count("--half-float")) {
+            options.halfFloat = true;
+            dict.erase("--half-float");
+        }
+
+        if (dict.count("--aovs")) {
+            options.features = true;
+            dict.erase("--aovs");
+        }
+
+        if (dict.count("--denoise")) {
+            options.features = true;
+            options.denoise = true;
+            dict.erase("--denoise");
+        }
+
         if (dict.count("--output")) {
             if (!options.output.empty()) {
                 options.displayHelp = true;
@@ -439,6 +608,18 @@ Options parseArgs(int argc, char const* const* argv) {
             }
         }
 
+        if (dict.count("--environment")) {
+            if (dict["--environment"].empty()) {
+                options.displayHelp = true;
+                options.displayMessage = "Invalid value for --environment.";
+                return options;
+            }
+            else {
+                options.environment = dict["--environment"];
+                dict.erase("--environment");
+            }
+        }
+
         if (dict.count("--camera")) {
             if (!isUnsigned(dict["--camera"])) {
                 options.displayHelp = true;
@@ -466,6 +647,67 @@ Options parseArgs(int argc, char const* const* argv) {
             }
         }
 
+        if (dict.count("--checkpoint")) {
+            if (!isReal(dict["--checkpoint"]) || atof(dict["--checkpoint"].c_str()) <= 0.0) {
+                options.displayHelp = true;
+                options.displayMessage = "Invalid value for --checkpoint.";
+                return options;
+            }
+            else if (!options.batch) {
+                options.displayHelp = true;
+                options.displayMessage = "--checkpoint can be specified in batch mode only.";
+                return options;
+            }
+            else {
+                options.checkpoint = atof(dict["--checkpoint"].c_str());
+                dict.erase("--checkpoint");
+            }
+        }
+
+        if (dict.count("--resume")) {
+            if (!options.batch) {
+                options.displayHelp = true;
+                options.displayMessage = "--resume can be specified in batch mode only.";
+                return options;
+            }
+            else {
+                options.resume = true;
+                dict.erase("--resume");
+            }
+        }
+
+        if (dict.count("--tile-size")) {
+            if (!isUnsigned(dict["--tile-size"]) || atoi(dict["--tile-size"].c_str()) == 0) {
+                options.displayHelp = true;
+                options.displayMessage = "Invalid value for --tile-size.";
+                return options;
+            }
+            else if (!options.batch || options.numSamples == 0 || options.snapshot != 0) {
+                options.displayHelp = true;
+                options.displayMessage = "--tile-size requires --batch and --num-samples, and cannot be used with --snapshot.";
+                return options;
+            }
+            else if (options.technique == Options::ReSTIR) {
+                options.displayHelp = true;
+                options.displayMessage = "--tile-size in not available for specified technique.";
+                return options;
+            }
+            else if (options.denoise) {
+                options.displayHelp = true;
+                options.displayMessage = "--tile-size cannot be used with --denoise.";
+                return options;
+            }
+            else if (options.checkpoint != 0.0 || options.resume) {
+                options.displayHelp = true;
+                options.displayMessage = "--tile-size cannot be used with --checkpoint or --resume.";
+                return options;
+            }
+            else {
+                options.tileSize = atoi(dict["--tile-size"].c_str());
+                dict.erase("--tile-size");
+            }
+        }
+
         if (dict.empty()) {
             return options;
         }
@@ -516,18 +758,25 @@ shared<Technique> makeTechnique(const Options& options) {
             {
                 return std::make_shared<BPT>(
                     options.minSubpath,
-                    options.roulette);
+                    options.roulette,
+                    options.minSurvival);
             }
             else
             {
                 return std::make_shared<MBPT>(
                     options.minSubpath,
                     options.roulette,
+                    options.minSurvival,
                     options.beta);
             }
 
         case Options::PT:
-            return std::make_shared<PathTracing>();
+            return std::make_shared<PathTracing>(
+                options.numLightSamples,
+                options.minSubpath,
+                options.roulette,
+                options.minSurvival,
+                options.splitting);
 
         case Options::PM:
             return std::make_shared<PhotonMapping>(
@@ -541,12 +790,28 @@ shared<Technique> makeTechnique(const Options& options) {
                 options.numGather,
                 options.maxRadius,
                 options.minSubpath,
-                options.roulette);
+                options.roulette,
+                options.minSurvival);
+
+        case Options::ReSTIR:
+            return std::make_shared<ReSTIR>(
+                options.numCandidates,
+                options.spatialReuse,
+                options.temporalReuse);
+
+        case Options::DI:
+            return std::make_shared<DirectIllumination>();
     }
 }
 
 shared<Scene> loadScene(const Options& options) {
-    return loadScene(options.input);
+    auto scene = loadScene(options.input, options.compressMeshes, options.sceneCache);
+
+    if (!options.environment.empty()) {
+        scene->environment = EnvironmentLight(options.environment);
+    }
+
+    return scene;
 }
 
 string techniqueString(const Options& options) {
@@ -555,6 +820,8 @@ string techniqueString(const Options& options) {
         case Options::PT: return "PT";
         case Options::PM: return "PM";
         case Options::VCM: return "VCM";
+        case Options::ReSTIR: return "ReSTIR";
+        case Options::DI: return "DI";
         default: return "UNKNOWN";
     }
 }
@@ -11,11 +11,12 @@ using std::string;
 template <class T> using shared = std::shared_ptr<T>;
 
 struct Options {
-    enum Technique { BPT, PT, PM, VCM };
+    enum Technique { BPT, PT, PM, VCM, ReSTIR, DI };
 
     string input;
     string output;
     string reference;
+    string environment;
     Technique technique = PT;
     size_t numPhotons = 100000;
     size_t numGather = 100;
@@ -23,12 +24,27 @@ struct Options {
     size_t minSubpath = 5;
     double beta = 1.0f;
     double roulette = 0.5;
+    double minSurvival = 0.1;
+    bool splitting = false;
+    size_t numLightSamples = 1;
+    size_t numCandidates = 32;
+    bool spatialReuse = false;
+    bool temporalReuse = false;
     bool batch = false;
+    bool preview = false;
     size_t numSamples = 0;
     double numSeconds = 0.0;
     bool parallel = false;
     bool reload = true;
+    bool compressMeshes = false;
+    bool sceneCache = false;
     size_t snapshot = 0;
+    bool halfFloat = false;
+    bool features = false;
+    bool denoise = false;
+    size_t tileSize = 0; // out-of-core rendering if not zero
+    double checkpoint = 0.0; // seconds between checkpoints
+    bool resume = false;
     size_t cameraId = 0;
     size_t width = 512;
     size_t height = 512;
@@ -1,29 +1,43 @@
 #include <iostream>
 #include <sstream>
-#include <GLFW/glfw3.h>
 #include <PathTracing.hpp>
 
 namespace haste {
 
-PathTracing::PathTracing() { }
+PathTracing::PathTracing(
+    size_t numLightSamples,
+    size_t minSubpath,
+    float roulette,
+    float minSurvival,
+    bool splitting)
+    : _numLightSamples(numLightSamples)
+    , _roulette(minSubpath, roulette, minSurvival, splitting) { }
 
 void PathTracing::render(
     ImageView& view,
     RandomEngine& engine,
     size_t cameraId)
 {
-    auto trace = [&](RandomEngine& engine, Ray ray) -> vec3 {
-        return this->trace(engine, ray);
+    auto trace = [&](RandomEngine& engine, Ray ray, float scale) -> vec3 {
+        return this->trace(engine, ray, scale);
     };
 
     for_each_ray(view, engine, _scene->cameras(), cameraId, trace);
 }
 
-vec3 PathTracing::trace(RandomEngine& engine, Ray ray) {
-    vec3 throughput = vec3(1.0f);
+vec3 PathTracing::trace(RandomEngine& engine, Ray ray, float scale) {
+    return _trace(engine, ray, vec3(1.0f), 0, scale);
+}
+
+vec3 PathTracing::_trace(
+    RandomEngine& engine,
+    Ray ray,
+    vec3 throughput,
+    int bounce,
+    float scale)
+{
     vec3 radiance = vec3(0.0f);
     bool specular = 0;
-    int bounce = 0;
 
     while (true) {
         auto isect = _scene->intersect(ray.origin, ray.direction);
@@ -38,6 +52,10 @@ vec3 PathTracing::trace(RandomEngine& engine, Ray ray) {
         }
 
         if (!isect.isPresent()) {
+            if (bounce == 0 || specular) {
+                radiance += throughput * _scene->queryEnvironment(ray.direction);
+            }
+
             break;
         }
 
@@ -48,10 +66,40 @@ vec3 PathTracing::trace(RandomEngine& engine, Ray ray) {
             engine,
             point,
             -ray.direction,
-            bsdf);
+            bsdf,
+            _numLightSamples);
 
         radiance += lightSample * throughput;
 
+        // bounce + 2 vertices including the camera
+        float expected = _roulette.expected(throughput, scale, bounce + 2);
+        size_t continuations = Roulette::sample(engine, expected);
+
+        if (continuations == 0) {
+            break;
+        }
+
+        throughput /= expected;
+
+        for (size_t i = 1; i < continuations; ++i) {
+            auto bsdfSample = bsdf.sample(
+                engine,
+                point,
+                -ray.direction);
+
+            Ray split = { isect.position(), bsdfSample.omega() };
+
+            radiance += _trace(
+                engine,
+                split,
+                throughput *
+                    bsdfSample.throughput() *
+                    abs(dot(point.normal(), bsdfSample.omega())) /
+                    bsdfSample.density(),
+                bounce + 1,
+                scale);
+        }
+
         auto bsdfSample = bsdf.sample(
             engine,
             point,
@@ -64,15 +112,6 @@ vec3 PathTracing::trace(RandomEngine& engine, Ray ray) {
         ray.direction = bsdfSample.omega();
         ray.origin = isect.position();
 
-        float prob = bounce > 5 ? 0.5f : 1.0f;
-
-        if (prob < _scene->sampler.sample()) {
-            break;
-        }
-        else {
-            throughput /= prob;
-        }
-
         ++bounce;
     }
 
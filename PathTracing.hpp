@@ -5,16 +5,32 @@ namespace haste {
 
 class PathTracing : public Technique {
 public:
-    PathTracing();
+    PathTracing(
+        size_t numLightSamples = 1,
+        size_t minSubpath = 5,
+        float roulette = 0.5f,
+        float minSurvival = 0.1f,
+        bool splitting = false);
 
     void render(
         ImageView& view,
         RandomEngine& engine,
         size_t cameraId) override;
 
-    vec3 trace(RandomEngine& engine, Ray ray);
+    vec3 trace(RandomEngine& engine, Ray ray, float scale = 0.0f);
 
     string name() const override;
+
+private:
+    size_t _numLightSamples;
+    const Roulette _roulette;
+
+    vec3 _trace(
+        RandomEngine& engine,
+        Ray ray,
+        vec3 throughput,
+        int bounce,
+        float scale);
 };
 
 }
@@ -1,6 +1,5 @@
 #include <runtime_assert>
 #include <cstring>
-#include <GLFW/glfw3.h>
 #include <PhotonMapping.hpp>
 
 namespace haste {
@@ -24,14 +23,14 @@ void PhotonMapping::preprocess(
 {
     Technique::preprocess(scene, engine, progress, parallel);
 
-    _totalPower = _scene->lights.totalPower();
+    _totalPower = _scene->totalPower();
 
     if (_auxiliary.empty()) {
         _numEmitted = 0;
     }
 
     const size_t batchSize = 1000;
-    double startTime = glfwGetTime();
+    double startTime = secondsSinceStart();
 
     while (_numEmitted < _numPhotons) {
         const size_t begin = _numEmitted;
@@ -41,7 +40,7 @@ void PhotonMapping::preprocess(
         _scatterPhotons(engine, begin, end);
         _numEmitted = end;
 
-        double time = glfwGetTime();
+        double time = secondsSinceStart();
         if (time - startTime < 0.033f) {
             progress("Scattering photons", float(_numEmitted) / float(_numPhotons));
             startTime = time;
@@ -59,7 +58,7 @@ void PhotonMapping::render(
     RandomEngine& engine,
     size_t cameraId)
 {
-    auto trace = [&](RandomEngine& engine, Ray ray) -> vec3 {
+    auto trace = [&](RandomEngine& engine, Ray ray, float) -> vec3 {
         return _gather(engine, ray);
     };
 
@@ -112,7 +111,7 @@ void PhotonMapping::_scatterPhotons(RandomEngine& engine, size_t begin, size_t e
     const float scaleFactor = _totalPower * _numPhotonsInv;
 
     for (size_t i = begin; i < end; ++i) {
-        Photon photon = _scene->lights.emit(engine);
+        Photon photon = _scene->emit(engine);
         photon.power *= scaleFactor;
 
         for (size_t j = 0; ; ++j) {
@@ -199,6 +198,9 @@ vec3 PhotonMapping::_gather(RandomEngine& source, Ray ray) {
             radiance += result / (radius2 * pi<float>());
         }
     }
+    else {
+        radiance += _scene->queryEnvironment(ray.direction);
+    }
 
     return radiance;
 }
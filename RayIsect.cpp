@@ -16,23 +16,20 @@ inline void setShadow(
             : RayIsect::lightMask());
 }
 
-const unsigned newMesh(RTCScene scene, const Geometry& geometry) {
+const unsigned newMesh(
+    RTCScene scene,
+    const Geometry& geometry,
+    RTCGeometryFlags flags)
+{
     if (geometry.usesTriangles()) {
         unsigned geomId = rtcNewTriangleMesh(
             scene,
-            RTC_GEOMETRY_STATIC,
+            flags,
             geometry.numTriangles(),
             geometry.numVertices(),
             1);
 
-        int* indices = (int*)rtcMapBuffer(scene, geomId, RTC_INDEX_BUFFER);
-        vec4* vertices = (vec4*)rtcMapBuffer(scene, geomId, RTC_VERTEX_BUFFER);
-
-        geometry.updateBuffers(indices, vertices);
-
-        rtcUnmapBuffer(scene, geomId, RTC_INDEX_BUFFER);
-        rtcUnmapBuffer(scene, geomId, RTC_VERTEX_BUFFER);
-
+        updateMesh(scene, geomId, geometry);
         setShadow(scene, geomId, geometry);
 
         return geomId;
@@ -42,23 +39,26 @@ const unsigned newMesh(RTCScene scene, const Geometry& geometry) {
 
         unsigned geomId = rtcNewQuadMesh(
             scene,
-            RTC_GEOMETRY_STATIC,
+            flags,
             geometry.numQuads(),
             geometry.numVertices(),
             1);
 
-        int* indices = (int*)rtcMapBuffer(scene, geomId, RTC_INDEX_BUFFER);
-        vec4* vertices = (vec4*)rtcMapBuffer(scene, geomId, RTC_VERTEX_BUFFER);
-
-        geometry.updateBuffers(indices, vertices);
-
-        rtcUnmapBuffer(scene, geomId, RTC_INDEX_BUFFER);
-        rtcUnmapBuffer(scene, geomId, RTC_VERTEX_BUFFER);
-
+        updateMesh(scene, geomId, geometry);
         setShadow(scene, geomId, geometry);
 
         return geomId;
     }
 }
 
+void updateMesh(RTCScene scene, unsigned geomId, const Geometry& geometry) {
+    int* indices = (int*)rtcMapBuffer(scene, geomId, RTC_INDEX_BUFFER);
+    vec4* vertices = (vec4*)rtcMapBuffer(scene, geomId, RTC_VERTEX_BUFFER);
+
+    geometry.updateBuffers(indices, vertices);
+
+    rtcUnmapBuffer(scene, geomId, RTC_INDEX_BUFFER);
+    rtcUnmapBuffer(scene, geomId, RTC_VERTEX_BUFFER);
+}
+
 }
@@ -26,6 +26,11 @@ public:
     const vec3 position() const { return *cpvec3(org) + *cpvec3(dir) * tfar; }
 };
 
-const unsigned newMesh(RTCScene scene, const Geometry& geometry);
+const unsigned newMesh(
+    RTCScene scene,
+    const Geometry& geometry,
+    RTCGeometryFlags flags = RTC_GEOMETRY_STATIC);
+
+void updateMesh(RTCScene scene, unsigned geomId, const Geometry& geometry);
 
 }
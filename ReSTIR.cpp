@@ -0,0 +1,233 @@
+#include <ReSTIR.hpp>
+
+namespace haste {
+
+static const size_t spatialNeighbours = 5;
+static const float spatialRadius = 16.0f;
+static const float temporalCap = 20.0f; // relative to the number of candidates
+
+ReSTIR::ReSTIR(size_t numCandidates, bool spatialReuse, bool temporalReuse)
+    : _numCandidates(numCandidates)
+    , _spatialReuse(spatialReuse)
+    , _temporalReuse(temporalReuse) { }
+
+void ReSTIR::preprocess(
+    const shared<const Scene>& scene,
+    RandomEngine& engine,
+    const function<void(string, float)>& progress,
+    bool parallel)
+{
+    Technique::preprocess(scene, engine, progress, parallel);
+    _pixels.clear();
+    _previous.clear();
+}
+
+bool ReSTIR::_renderPass(
+    ImageView& view,
+    RandomEngine& engine,
+    size_t cameraId,
+    bool parallel)
+{
+    const size_t size = view.width() * view.height();
+
+    if (_pixels.size() != size) {
+        _pixels = vector<Pixel>(size);
+        _previous = vector<Pixel>(size);
+    }
+
+    // Tiles rendered in parallel touch disjoint pixels of both buffers. The
+    // shading reads neighbours from other tiles, so it waits for _pixels to
+    // be complete. A pass interrupted while sampling leaves the image as is.
+    bool completed = _forEachTile(view, engine, parallel, [&](ImageView& tile, RandomEngine& engine) {
+        _sampleTile(tile, engine, cameraId);
+    });
+
+    return completed && _forEachTile(view, engine, parallel, [&](ImageView& tile, RandomEngine& engine) {
+        _shadeTile(tile, engine, view);
+    });
+}
+
+void ReSTIR::render(
+    ImageView& view,
+    RandomEngine& engine,
+    size_t cameraId)
+{
+    _renderPass(view, engine, cameraId, false);
+}
+
+void ReSTIR::_sampleTile(ImageView& view, RandomEngine& engine, size_t cameraId) {
+    const int xBegin = int(view.xBegin());
+    const int xEnd = int(view.xEnd());
+    const int yBegin = int(view.yBegin());
+    const int yEnd = int(view.yEnd());
+    const int width = int(view.width());
+
+    runtime_assert(0 <= xBegin && xEnd <= view.width());
+    runtime_assert(0 <= yBegin && yEnd <= view.height());
+
+    const float widthInv = 1.0f / float(view.width());
+    const float heightInv = 1.0f / float(view.height());
+    const float aspect = float(view.width()) / float(view.height());
+
+    // candidates and temporal reuse
+    for (int y = yBegin; y < yEnd; ++y) {
+        for (int x = xBegin; x < xEnd; ++x) {
+            Pixel& pixel = _pixels[y * width + x];
+
+            const Ray ray = _scene->cameras().shoot(
+                cameraId,
+                engine,
+                widthInv,
+                heightInv,
+                aspect,
+                float(x),
+                float(y));
+
+            _sample(engine, pixel, ray);
+
+            if (view.hasFeatures()) {
+                _accumulateFeatures(view, ray, x, y);
+            }
+
+            if (_temporalReuse) {
+                _reuse(engine, pixel, _previous[y * width + x]);
+            }
+        }
+    }
+}
+
+void ReSTIR::_shadeTile(ImageView& view, RandomEngine& engine, const ImageView& window) {
+    const int xBegin = int(view.xBegin());
+    const int xEnd = int(view.xEnd());
+    const int yBegin = int(view.yBegin());
+    const int yEnd = int(view.yEnd());
+    const int width = int(view.width());
+
+    runtime_assert(0 <= xBegin && xEnd <= view.width());
+    runtime_assert(0 <= yBegin && yEnd <= view.height());
+
+    const int xMin = int(window.xBegin());
+    const int xMax = int(window.xEnd()) - 1;
+    const int yMin = int(window.yBegin());
+    const int yMax = int(window.yEnd()) - 1;
+
+    // spatial reuse and shading, neighbours are taken from the whole view
+    for (int y = yBegin; y < yEnd; ++y) {
+        for (int x = xBegin; x < xEnd; ++x) {
+            const Pixel& pixel = _pixels[y * width + x];
+            Pixel& result = _previous[y * width + x];
+
+            result = pixel;
+
+            if (pixel.bsdf != nullptr && _spatialReuse) {
+                for (size_t i = 0; i < spatialNeighbours; ++i) {
+                    vec2 offset = (sampleUniform2(engine).value() * 2.0f - 1.0f) * spatialRadius;
+                    int nx = clamp(x + int(offset.x), xMin, xMax);
+                    int ny = clamp(y + int(offset.y), yMin, yMax);
+
+                    if (nx != x || ny != y) {
+                        _reuse(engine, result, _pixels[ny * width + nx]);
+                    }
+                }
+            }
+
+            vec3 radiance = result.radiance;
+
+            if (result.bsdf != nullptr && result.reservoir.weightSum > 0.0f) {
+                const LightCandidate& candidate = result.reservoir.candidate;
+
+                float visible = _scene->occluded(result.surface, candidate);
+
+                radiance +=
+                    _scene->queryLightCandidate(
+                        result.surface,
+                        result.omega,
+                        *result.bsdf,
+                        candidate) *
+                    visible *
+                    result.reservoir.weight();
+
+                // Occluded candidates would only spread shadow to neighbours.
+                if (visible == 0.0f) {
+                    result.reservoir.weightSum = 0.0f;
+                }
+            }
+
+            float cumulative = radiance.x + radiance.y + radiance.z;
+            view.absAt(x, y) += std::isfinite(cumulative) ? vec4(radiance, 1.0f) : vec4(0.0f);
+
+            if (view.hasFeatures()) {
+                _accumulateMoments(view, radiance, x, y);
+            }
+        }
+    }
+}
+
+string ReSTIR::name() const {
+    return "ReSTIR Direct Illumination";
+}
+
+void ReSTIR::_sample(RandomEngine& engine, Pixel& pixel, Ray ray) {
+    pixel.radiance = vec3(0.0f);
+    pixel.bsdf = nullptr;
+    pixel.reservoir = LightReservoir();
+
+    auto isect = _scene->intersect(ray);
+
+    while (isect.isLight()) {
+        pixel.radiance += _scene->queryRadiance(isect);
+
+        ray.origin = isect.position();
+        isect = _scene->intersect(ray);
+    }
+
+    if (!isect.isPresent()) {
+        pixel.radiance += _scene->queryEnvironment(ray.direction);
+        return;
+    }
+
+    pixel.surface = _scene->querySurface(isect);
+    pixel.omega = -ray.direction;
+    pixel.bsdf = &_scene->queryBSDF(isect);
+    pixel.depth = distance(ray.origin, isect.position());
+
+    pixel.reservoir = _scene->sampleLightReservoir(
+        engine,
+        pixel.surface,
+        pixel.omega,
+        *pixel.bsdf,
+        _numCandidates);
+}
+
+void ReSTIR::_reuse(RandomEngine& engine, Pixel& pixel, const Pixel& that) {
+    if (!_similar(pixel, that) || that.reservoir.weightSum <= 0.0f) {
+        return;
+    }
+
+    const LightReservoir& reservoir = that.reservoir;
+
+    vec3 contribution = _scene->queryLightCandidate(
+        pixel.surface,
+        pixel.omega,
+        *pixel.bsdf,
+        reservoir.candidate);
+
+    float target = contribution.x + contribution.y + contribution.z;
+    float count = min(reservoir.count, temporalCap * float(_numCandidates));
+
+    pixel.reservoir.update(
+        reservoir.candidate,
+        target,
+        target * reservoir.weight() * count,
+        count,
+        sampleUniform1(engine).value());
+}
+
+const bool ReSTIR::_similar(const Pixel& a, const Pixel& b) const {
+    return a.bsdf != nullptr
+        && b.bsdf != nullptr
+        && dot(a.surface.normal(), b.surface.normal()) > 0.9f
+        && abs(a.depth - b.depth) < 0.1f * a.depth;
+}
+
+}
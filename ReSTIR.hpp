@@ -0,0 +1,57 @@
+#pragma once
+#include <Technique.hpp>
+
+namespace haste {
+
+// Direct illumination with reservoir resampling of light candidates, only
+// a single shadow ray is traced per pixel. Reservoirs can be reused from
+// neighbouring pixels (spatial) and from the previous pass (temporal).
+// Every pass samples all the reservoirs first and shades afterwards, so
+// spatial neighbours come from anywhere in the view, not just the tile.
+class ReSTIR : public Technique {
+public:
+    ReSTIR(size_t numCandidates, bool spatialReuse, bool temporalReuse);
+
+    void preprocess(
+        const shared<const Scene>& scene,
+        RandomEngine& engine,
+        const function<void(string, float)>& progress,
+        bool parallel = false) override;
+
+    void render(
+        ImageView& view,
+        RandomEngine& engine,
+        size_t cameraId) override;
+
+    string name() const override;
+
+private:
+    struct Pixel {
+        SurfacePoint surface;
+        vec3 omega; // towards the camera
+        vec3 radiance; // emitted or from the environment
+        const BSDF* bsdf = nullptr;
+        float depth = 0.0f;
+        LightReservoir reservoir;
+    };
+
+    size_t _numCandidates;
+    bool _spatialReuse;
+    bool _temporalReuse;
+    vector<Pixel> _pixels;
+    vector<Pixel> _previous;
+
+    bool _renderPass(
+        ImageView& view,
+        RandomEngine& engine,
+        size_t cameraId,
+        bool parallel) override;
+
+    void _sampleTile(ImageView& tile, RandomEngine& engine, size_t cameraId);
+    void _shadeTile(ImageView& tile, RandomEngine& engine, const ImageView& window);
+    void _sample(RandomEngine& engine, Pixel& pixel, Ray ray);
+    void _reuse(RandomEngine& engine, Pixel& pixel, const Pixel& that);
+    const bool _similar(const Pixel& a, const Pixel& b) const;
+};
+
+}
@@ -0,0 +1,65 @@
+#include <Roulette.hpp>
+
+namespace haste {
+
+// Weight window of ADRRS around 1 with the ratio of its bounds equal to 5.
+static const float windowLower = 1.0f / 3.0f;
+static const float windowUpper = 5.0f / 3.0f;
+static const float maxSplits = 8.0f;
+static const float maxPixelScale = 8.0f;
+static const size_t maxLength = 1024; // inside the window paths never end
+
+Roulette::Roulette(
+    size_t minSubpath,
+    float roulette,
+    float minSurvival,
+    bool splitting)
+    : _minSubpath(minSubpath)
+    , _roulette(roulette)
+    , _minSurvival(minSurvival)
+    , _splitting(splitting) { }
+
+const float Roulette::expected(const vec3& throughput, float scale, size_t length) const {
+    if (length >= maxLength) {
+        return 0.0f;
+    }
+    else if (length < _minSubpath) {
+        return 1.0f;
+    }
+    else if (scale <= 0.0f) {
+        return _roulette;
+    }
+
+    const float ratio = (throughput.x + throughput.y + throughput.z) / 3.0f * scale;
+
+    if (ratio < windowLower) {
+        return ratio > 0.0f ? std::max(ratio, _minSurvival) : 0.0f;
+    }
+    else if (_splitting && ratio > windowUpper) {
+        return std::min(ratio, maxSplits);
+    }
+    else {
+        return 1.0f;
+    }
+}
+
+const float Roulette::expected(size_t length) const {
+    return expected(vec3(0.0f), 0.0f, length);
+}
+
+size_t Roulette::sample(RandomEngine& engine, float expected) {
+    const float whole = floor(expected);
+    return size_t(whole) + (sampleUniform1(engine).value() < expected - whole ? 1 : 0);
+}
+
+float Roulette::pixelScale(const vec4& pixel, float mean) {
+    const float value = (pixel.x + pixel.y + pixel.z) / std::max(pixel.w, 1.0f);
+
+    if (pixel.w == 0.0f || value <= 0.0f || mean <= 0.0f) {
+        return 0.0f;
+    }
+
+    return clamp(mean / value, 1.0f / maxPixelScale, maxPixelScale);
+}
+
+}
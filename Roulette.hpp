@@ -0,0 +1,43 @@
+#pragma once
+#include <glm>
+#include <Sample.hpp>
+
+namespace haste {
+
+// Russian roulette and splitting driven by the expected contribution of a
+// path (ADRRS, Vorba and Krivanek 2016). Instead of a radiance cache, the
+// radiance arriving at a vertex is approximated by the mean of the image.
+// Paths are then kept close to throughput * scale == 1, where scale is the
+// image mean over the current estimate of the pixel (see pixelScale).
+// Without an estimate the fixed survival coefficient is used instead.
+class Roulette {
+public:
+    Roulette(
+        size_t minSubpath = 5,
+        float roulette = 0.5f,
+        float minSurvival = 0.1f,
+        bool splitting = false);
+
+    // Expected number of continuations of a subpath of given length, below
+    // one it is the survival probability. Always one for short subpaths,
+    // zero past a hard length limit. Zero scale means there is no estimate.
+    const float expected(const vec3& throughput, float scale, size_t length) const;
+
+    // Survival probability of subpaths without an estimate of their
+    // contribution, such as light subpaths.
+    const float expected(size_t length) const;
+
+    // Number of continuations with the given expectation.
+    static size_t sample(RandomEngine& engine, float expected);
+
+    // Image mean over the pixel estimate, zero if there is no estimate yet.
+    static float pixelScale(const vec4& pixel, float mean);
+
+private:
+    size_t _minSubpath;
+    float _roulette;
+    float _minSurvival;
+    bool _splitting;
+};
+
+}
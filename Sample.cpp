@@ -1,3 +1,4 @@
+#include <sstream>
 #include <Sample.hpp>
 
 namespace haste {
@@ -7,10 +8,37 @@ RandomEngine::RandomEngine() {
     engine.seed(device());
 }
 
+RandomEngine::RandomEngine(std::uint32_t seed) {
+    engine.seed(seed);
+}
+
 RandomEngine::RandomEngine(RandomEngine&& that)
     : engine(std::move(that.engine)) {
 }
 
+std::uint32_t RandomEngine::seed() {
+    return std::uint32_t(engine());
+}
+
+std::string RandomEngine::state() const {
+    std::stringstream stream;
+    stream << engine;
+    return stream.str();
+}
+
+bool RandomEngine::restore(const std::string& state) {
+    std::stringstream stream(state);
+    std::minstd_rand restored;
+    stream >> restored;
+
+    if (stream.fail()) {
+        return false;
+    }
+
+    engine = restored;
+    return true;
+}
+
 float RandomEngine::random1() {
     return std::uniform_real_distribution<float>()(engine);
 }
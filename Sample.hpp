@@ -1,5 +1,7 @@
 #pragma once
+#include <cstdint>
 #include <random>
+#include <string>
 #include <glm>
 
 namespace haste {
@@ -7,8 +9,16 @@ namespace haste {
 struct RandomEngine {
 public:
     RandomEngine();
+    explicit RandomEngine(std::uint32_t seed);
     RandomEngine(RandomEngine&& that);
 
+    // Seed for an engine used by another thread.
+    std::uint32_t seed();
+
+    // Position in the stream, for checkpoints.
+    std::string state() const;
+    bool restore(const std::string& state);
+
     float random1();
     vec2 random2();
     vec3 random3();
@@ -1,86 +1,638 @@
 #include <runtime_assert>
 #include <Scene.hpp>
 #include <streamops.hpp>
+#include <cfloat>
 #include <cstring>
+#include <typeinfo>
 
 namespace haste {
 
+// Meshes are processed in parallel, big meshes are split further in chunks.
+vector<Mesh> updateShading(vector<Mesh>&& meshes) {
+    tbb::parallel_for(size_t(0), meshes.size(), [&](size_t i) {
+        Mesh& mesh = meshes[i];
+        const size_t numTriangles = mesh.indices.size() / 3;
+        mesh.shading.resize(numTriangles);
+
+        parallelChunks(numTriangles, [&](size_t j) {
+            for (size_t k = 0; k < 3; ++k) {
+                const int index = mesh.indices[j * 3 + k];
+                mesh.shading[j].normals[k] = mesh.normals[index];
+                mesh.shading[j].tangents[k] = mesh.tangents[index];
+            }
+        });
+
+        // The records are all shading reads, the vertex arrays would only
+        // double the memory.
+        vector<vec3>().swap(mesh.normals);
+        vector<vec3>().swap(mesh.tangents);
+        vector<vec3>().swap(mesh.bitangents);
+    });
+
+    return move(meshes);
+}
+
+vector<Mesh> compressShading(vector<Mesh>&& meshes) {
+    tbb::parallel_for(size_t(0), meshes.size(), [&](size_t i) {
+        Mesh& mesh = meshes[i];
+        const size_t numVertices = mesh.vertices.size();
+        mesh.packedNormals.resize(numVertices);
+        mesh.packedTangents.resize(numVertices);
+
+        parallelChunks(numVertices, [&](size_t j) {
+            mesh.packedNormals[j] = encodeOctahedral(normalize(mesh.normals[j]));
+            mesh.packedTangents[j] = encodeOctahedral(normalize(mesh.tangents[j]));
+        });
+
+        vector<vec3>().swap(mesh.normals);
+        vector<vec3>().swap(mesh.tangents);
+        vector<vec3>().swap(mesh.bitangents);
+        vector<TriangleShading>().swap(mesh.shading);
+
+        // Embree reads vertices shared with it as 16 byte loads, the last one
+        // is followed by a copy which isn't referenced (and keeps the bounds).
+        mesh.vertices.push_back(numVertices != 0 ? mesh.vertices.back() : vec3(0.0f));
+        mesh.compressed = true;
+    });
+
+    return move(meshes);
+}
+
+vector<Instance> updateInstances(vector<Instance>&& instances) {
+    for (auto& instance : instances) {
+        instance.normalTransform = transpose(inverse(mat3(instance.transform)));
+    }
+
+    return move(instances);
+}
+
 Scene::Scene(
     Cameras&& cameras,
     Materials&& materials,
     vector<Mesh>&& meshes,
-    AreaLights&& areaLights)
+    vector<Instance>&& instances,
+    AreaLights&& areaLights,
+    bool compressMeshes)
     : _cameras(cameras)
-    , materials(move(materials))
-    , meshes(move(meshes))
+    , meshes(compressMeshes
+        ? compressShading(move(meshes))
+        : updateShading(move(meshes)))
+    , instances(updateInstances(move(instances)))
     , lights(move(areaLights))
+    , materials(move(materials))
 {
     rtcScene = nullptr;
+    rtcLightScene = nullptr;
 
     _numIntersectRays = 0;
     _numOccludedRays = 0;
 
     lights.init(this);
+    _updateBounds();
 }
 
-unsigned makeRTCMesh(RTCScene rtcScene, size_t i, const vector<Mesh>& meshes) {
-    unsigned geomID = rtcNewTriangleMesh(
-        rtcScene,
-        RTC_GEOMETRY_STATIC,
-        meshes[i].indices.size() / 3,
-        meshes[i].vertices.size(),
-        1);
+void Scene::_updateBounds() {
+    vec3 lower = vec3(FLT_MAX);
+    vec3 upper = vec3(-FLT_MAX);
+    vector<pair<vec3, vec3>> prototypes(meshes.size());
+
+    for (size_t i = 0; i < meshes.size(); ++i) {
+        vec3 meshLower = vec3(FLT_MAX);
+        vec3 meshUpper = vec3(-FLT_MAX);
+
+        for (auto&& vertex : meshes[i].vertices) {
+            meshLower = min(meshLower, vertex);
+            meshUpper = max(meshUpper, vertex);
+        }
+
+        if (meshes[i].instanced) {
+            prototypes[i] = std::make_pair(meshLower, meshUpper);
+        }
+        else {
+            lower = min(lower, meshLower);
+            upper = max(upper, meshUpper);
+        }
+    }
 
-    vec4* vbuffer = (vec4*) rtcMapBuffer(rtcScene, geomID, RTC_VERTEX_BUFFER);
+    for (auto&& instance : instances) {
+        const auto& bounds = prototypes[instance.meshId];
+
+        for (size_t corner = 0; corner < 8; ++corner) {
+            vec3 position = vec3(
+                corner & 1 ? bounds.second.x : bounds.first.x,
+                corner & 2 ? bounds.second.y : bounds.first.y,
+                corner & 4 ? bounds.second.z : bounds.first.z);
+
+            position = vec3(instance.transform * vec4(position, 1.0f));
+            lower = min(lower, position);
+            upper = max(upper, position);
+        }
+    }
+
+    for (auto&& corner : lights._corners) {
+        lower = min(lower, corner);
+        upper = max(upper, corner);
+    }
 
-    for (size_t j = 0; j < meshes[i].vertices.size(); ++j) {
-        vbuffer[j].x = meshes[i].vertices[j].x;
-        vbuffer[j].y = meshes[i].vertices[j].y;
-        vbuffer[j].z = meshes[i].vertices[j].z;
-        vbuffer[j].w = 1;
+    if (lower.x <= upper.x) {
+        _center = (lower + upper) * 0.5f;
+        _radius = max(length(upper - _center), 0.001f);
+    }
+    else {
+        _center = vec3(0.0f);
+        _radius = 1.0f;
+    }
+}
+
+Scene::~Scene() {
+    if (rtcScene) {
+        rtcDeleteScene(rtcScene);
+    }
+
+    if (rtcLightScene) {
+        rtcDeleteScene(rtcLightScene);
+    }
+
+    for (size_t i = 0; i < rtcPrototypes.size(); ++i) {
+        if (rtcPrototypes[i]) {
+            rtcDeleteScene(rtcPrototypes[i]);
+        }
+    }
+}
+
+void copyRTCVertices(vec4* dst, const vector<vec3>& vertices) {
+    parallelChunks(vertices.size(), [&](size_t j) {
+        dst[j] = vec4(vertices[j], 1.0f);
+    });
+}
+
+void updateRTCVertices(RTCScene rtcScene, unsigned geomID, const Mesh& mesh) {
+    if (mesh.compressed) {
+        rtcUpdateBuffer(rtcScene, geomID, RTC_VERTEX_BUFFER);
+        return;
     }
 
+    vec4* vbuffer = (vec4*) rtcMapBuffer(rtcScene, geomID, RTC_VERTEX_BUFFER);
+    copyRTCVertices(vbuffer, mesh.vertices);
     rtcUnmapBuffer(rtcScene, geomID, RTC_VERTEX_BUFFER);
+}
 
-    int* triangles = (int*) rtcMapBuffer(rtcScene, geomID, RTC_INDEX_BUFFER);
-    std::memcpy(
-        triangles,
-        meshes[i].indices.data(),
-        meshes[i].indices.size() * sizeof(int));
+struct RTCMeshUpload {
+    RTCScene rtcScene;
+    unsigned geomID;
+    const Mesh* mesh;
+    vec4* vertices;
+    int* indices;
+};
+
+unsigned makeRTCMesh(
+    RTCScene rtcScene,
+    const Mesh& mesh,
+    bool dynamic,
+    vector<RTCMeshUpload>& uploads)
+{
+    // Without the padding vertex of compressed meshes.
+    const size_t numVertices = mesh.vertices.size() - size_t(mesh.compressed);
 
-    rtcUnmapBuffer(rtcScene, geomID, RTC_INDEX_BUFFER);
+    unsigned geomID = rtcNewTriangleMesh(
+        rtcScene,
+        dynamic ? RTC_GEOMETRY_DEFORMABLE : RTC_GEOMETRY_STATIC,
+        mesh.indices.size() / 3,
+        numVertices,
+        1);
+
+    if (mesh.compressed) {
+        rtcSetBuffer(
+            rtcScene,
+            geomID,
+            RTC_VERTEX_BUFFER,
+            mesh.vertices.data(),
+            0,
+            sizeof(vec3));
+
+        rtcSetBuffer(
+            rtcScene,
+            geomID,
+            RTC_INDEX_BUFFER,
+            mesh.indices.data(),
+            0,
+            sizeof(int) * 3);
+
+        return geomID;
+    }
+
+    RTCMeshUpload upload;
+    upload.rtcScene = rtcScene;
+    upload.geomID = geomID;
+    upload.mesh = &mesh;
+    upload.vertices = nullptr;
+    upload.indices = nullptr;
+    uploads.push_back(upload);
 
     return geomID;
 }
 
-void updateRTCScene(RTCScene& rtcScene, RTCDevice device, const Scene& scene) {
-    if (rtcScene) {
-        rtcDeleteScene(rtcScene);
+// Embree API calls on a scene are not thread safe, buffers are mapped and
+// unmapped serially and only the copies run in parallel.
+void uploadRTCMeshes(vector<RTCMeshUpload>& uploads) {
+    for (auto& upload : uploads) {
+        upload.vertices = (vec4*) rtcMapBuffer(
+            upload.rtcScene,
+            upload.geomID,
+            RTC_VERTEX_BUFFER);
+
+        upload.indices = (int*) rtcMapBuffer(
+            upload.rtcScene,
+            upload.geomID,
+            RTC_INDEX_BUFFER);
+    }
+
+    tbb::parallel_for(size_t(0), uploads.size(), [&](size_t i) {
+        const Mesh& mesh = *uploads[i].mesh;
+        copyRTCVertices(uploads[i].vertices, mesh.vertices);
+
+        std::memcpy(
+            uploads[i].indices,
+            mesh.indices.data(),
+            mesh.indices.size() * sizeof(int));
+    });
+
+    for (auto& upload : uploads) {
+        rtcUnmapBuffer(upload.rtcScene, upload.geomID, RTC_VERTEX_BUFFER);
+        rtcUnmapBuffer(upload.rtcScene, upload.geomID, RTC_INDEX_BUFFER);
     }
 
-    rtcScene = rtcDeviceNewScene(
+    uploads.clear();
+}
+
+RTCScene newRTCScene(RTCDevice device, bool dynamic) {
+    RTCScene rtcScene = rtcDeviceNewScene(
         device,
-        RTC_SCENE_STATIC | RTC_SCENE_HIGH_QUALITY,
-        RTC_INTERSECT1);
+        dynamic ? RTC_SCENE_DYNAMIC : RTC_SCENE_STATIC | RTC_SCENE_HIGH_QUALITY,
+        RTC_INTERSECT1 | RTC_INTERSECT4);
 
     if (rtcScene == nullptr) {
         throw std::runtime_error("Cannot create RTCScene.");
     }
 
-    unsigned geomID = newMesh(rtcScene, scene.lights);
+    return rtcScene;
+}
+
+void setRTCTransform(RTCScene rtcScene, unsigned geomID, const mat4& transform) {
+    float xfm[12];
+
+    for (size_t column = 0; column < 4; ++column) {
+        for (size_t row = 0; row < 3; ++row) {
+            xfm[column * 3 + row] = transform[column][row];
+        }
+    }
+
+    rtcSetTransform2(rtcScene, geomID, RTC_MATRIX_COLUMN_MAJOR, xfm);
+}
+
+void updateRTCScene(
+    RTCScene& rtcScene,
+    RTCDevice device,
+    const Scene& scene,
+    bool dynamic)
+{
+    if (rtcScene) {
+        rtcDeleteScene(rtcScene);
+    }
+
+    rtcScene = newRTCScene(device, dynamic);
+
+    unsigned geomID = newMesh(
+        rtcScene,
+        scene.lights,
+        dynamic ? RTC_GEOMETRY_DEFORMABLE : RTC_GEOMETRY_STATIC);
+
     runtime_assert(geomID == 0, "Area lights have to get 0 primID.");
 
+    vector<RTCMeshUpload> uploads;
+
     for (size_t i = 0; i < scene.meshes.size(); ++i) {
-        unsigned geomID = makeRTCMesh(rtcScene, i, scene.meshes);
+        unsigned geomID = makeRTCMesh(rtcScene, scene.meshes[i], dynamic, uploads);
         runtime_assert(geomID == i + 1, "Geometry ID doesn't correspond to mesh index.");
     }
 
+    uploadRTCMeshes(uploads);
+    rtcCommit(rtcScene);
+}
+
+//
+// Instanced scene layout (top level geometry IDs).
+//
+// 0 - instance of the light scene,
+// 1 - instance of the scene holding all world space meshes (geomID == meshId),
+// 2.. - instances of prototype meshes, Scene::instances[instID - 2].
+//
+// Every hit is an instance hit so instID is always set by Embree, the hits
+// are translated back to the flat layout by Scene::_resolveInstance.
+//
+
+static const unsigned lightInstanceID = 0;
+static const unsigned staticInstanceID = 1;
+static const unsigned firstInstanceID = 2;
+
+void updateRTCInstancedScene(
+    RTCScene& rtcScene,
+    vector<RTCScene>& rtcPrototypes,
+    RTCScene rtcLightScene,
+    RTCDevice device,
+    const Scene& scene)
+{
+    if (rtcScene) {
+        rtcDeleteScene(rtcScene);
+    }
+
+    for (size_t i = 0; i < rtcPrototypes.size(); ++i) {
+        if (rtcPrototypes[i]) {
+            rtcDeleteScene(rtcPrototypes[i]);
+        }
+    }
+
+    // rtcPrototypes.back() holds the world space meshes.
+    rtcPrototypes.assign(scene.meshes.size() + 1, nullptr);
+    RTCScene rtcStaticScene = rtcPrototypes.back() = newRTCScene(device, false);
+
+    vector<RTCMeshUpload> uploads;
+
+    for (size_t i = 0; i < scene.meshes.size(); ++i) {
+        if (scene.meshes[i].instanced) {
+            rtcPrototypes[i] = newRTCScene(device, false);
+            unsigned geomID = makeRTCMesh(rtcPrototypes[i], scene.meshes[i], false, uploads);
+            runtime_assert(geomID == 0);
+        }
+        else {
+            unsigned geomID = makeRTCMesh(rtcStaticScene, scene.meshes[i], false, uploads);
+            runtime_assert(geomID == i, "Instanced meshes have to follow world space meshes.");
+        }
+    }
+
+    uploadRTCMeshes(uploads);
+
+    for (size_t i = 0; i < scene.meshes.size(); ++i) {
+        if (rtcPrototypes[i]) {
+            rtcCommit(rtcPrototypes[i]);
+        }
+    }
+
+    rtcCommit(rtcStaticScene);
+
+    rtcScene = newRTCScene(device, false);
+
+    unsigned geomID = rtcNewInstance2(rtcScene, rtcLightScene);
+    runtime_assert(geomID == lightInstanceID);
+    setRTCTransform(rtcScene, geomID, mat4(1.0f));
+    rtcSetMask(rtcScene, geomID, RayIsect::lightMask());
+
+    geomID = rtcNewInstance2(rtcScene, rtcStaticScene);
+    runtime_assert(geomID == staticInstanceID);
+    setRTCTransform(rtcScene, geomID, mat4(1.0f));
+
+    for (size_t i = 0; i < scene.instances.size(); ++i) {
+        const Instance& instance = scene.instances[i];
+        runtime_assert(scene.meshes[instance.meshId].instanced);
+
+        geomID = rtcNewInstance2(rtcScene, rtcPrototypes[instance.meshId]);
+        runtime_assert(geomID == i + firstInstanceID);
+        setRTCTransform(rtcScene, geomID, instance.transform);
+    }
+
+    rtcCommit(rtcScene);
+}
+
+void updateRTCLightScene(
+    RTCScene& rtcScene,
+    RTCDevice device,
+    const Scene& scene,
+    bool dynamic)
+{
+    if (rtcScene) {
+        rtcDeleteScene(rtcScene);
+    }
+
+    rtcScene = newRTCScene(device, dynamic);
+
+    unsigned geomID = newMesh(
+        rtcScene,
+        scene.lights,
+        dynamic ? RTC_GEOMETRY_DEFORMABLE : RTC_GEOMETRY_STATIC);
+
+    runtime_assert(geomID == 0, "Area lights have to get 0 primID.");
+
     rtcCommit(rtcScene);
 }
 
-void Scene::buildAccelStructs(RTCDevice device) {
+void Scene::buildAccelStructs(RTCDevice device, bool dynamic) {
+    _device = device;
+    _dynamic = dynamic && instances.empty();
+
+    if (rtcLightScene == nullptr) {
+        updateRTCLightScene(rtcLightScene, device, *this, _dynamic);
+    }
+
     if (rtcScene == nullptr) {
-        updateRTCScene(rtcScene, device, *this);
+        if (instances.empty()) {
+            updateRTCScene(rtcScene, device, *this, _dynamic);
+        }
+        else {
+            updateRTCInstancedScene(
+                rtcScene,
+                rtcPrototypes,
+                rtcLightScene,
+                device,
+                *this);
+        }
+    }
+}
+
+bool equalCameras(const Cameras& a, const Cameras& b) {
+    if (a.numCameras() != b.numCameras()) {
+        return false;
+    }
+
+    for (size_t i = 0; i < a.numCameras(); ++i) {
+        if (a.name(i) != b.name(i) ||
+            a.position(i) != b.position(i) ||
+            a.direction(i) != b.direction(i) ||
+            a.up(i) != b.up(i) ||
+            a.fovx(i, 1.0f) != b.fovx(i, 1.0f) ||
+            a.near(i) != b.near(i) ||
+            a.far(i) != b.far(i)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool equalMaterials(const Materials& a, const Materials& b) {
+    if (a.names != b.names ||
+        a.diffuses != b.diffuses ||
+        a.emissives != b.emissives ||
+        a.speculars != b.speculars ||
+        a.iors != b.iors ||
+        a.bsdfs.size() != b.bsdfs.size()) {
+        return false;
+    }
+
+    for (size_t i = 0; i < a.bsdfs.size(); ++i) {
+        if (typeid(*a.bsdfs[i]) != typeid(*b.bsdfs[i])) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool equalShading(const Mesh& a, const Mesh& b) {
+    return a.shading.size() == b.shading.size()
+        && std::memcmp(
+            a.shading.data(),
+            b.shading.data(),
+            a.shading.size() * sizeof(TriangleShading)) == 0
+        && a.packedNormals == b.packedNormals
+        && a.packedTangents == b.packedTangents;
+}
+
+unsigned Scene::diff(const Scene& that) const {
+    unsigned changes = SceneChangeNone;
+
+    if (meshes.size() != that.meshes.size() ||
+        instances.size() != that.instances.size() ||
+        lights.numLights() != that.lights.numLights()) {
+        return SceneChangeTopology;
+    }
+
+    for (size_t i = 0; i < meshes.size(); ++i) {
+        const Mesh& a = meshes[i];
+        const Mesh& b = that.meshes[i];
+
+        if (a.vertices.size() != b.vertices.size() ||
+            a.indices != b.indices ||
+            a.compressed != b.compressed ||
+            a.instanced != b.instanced) {
+            return SceneChangeTopology;
+        }
+
+        if (a.vertices != b.vertices) {
+            changes |= SceneChangeVertices;
+        }
+
+        if (!equalShading(a, b) || a.materialID != b.materialID) {
+            changes |= SceneChangeShading;
+        }
+    }
+
+    for (size_t i = 0; i < instances.size(); ++i) {
+        if (instances[i].meshId != that.instances[i].meshId ||
+            instances[i].transform != that.instances[i].transform) {
+            return SceneChangeTopology;
+        }
+    }
+
+    if (lights._corners != that.lights._corners ||
+        lights._exitances != that.lights._exitances) {
+        changes |= SceneChangeLights;
+    }
+
+    if (!equalCameras(_cameras, that._cameras)) {
+        changes |= SceneChangeCameras;
+    }
+
+    if (!equalMaterials(materials, that.materials)) {
+        changes |= SceneChangeMaterials;
+    }
+
+    return changes;
+}
+
+void Scene::update(Scene&& that, unsigned changes) {
+    runtime_assert(!(changes & SceneChangeTopology));
+
+    if (changes & SceneChangeCameras) {
+        _cameras = move(that._cameras);
+    }
+
+    if (changes & SceneChangeMaterials) {
+        materials = move(that.materials);
+    }
+
+    bool rebuild = !_dynamic && (changes & (SceneChangeLights | SceneChangeVertices));
+
+    if (changes & SceneChangeLights) {
+        lights = move(that.lights);
+        lights.init(this);
+
+        if (rtcScene && !rebuild) {
+            updateMesh(rtcScene, 0, lights);
+            rtcUpdate(rtcScene, 0);
+            updateMesh(rtcLightScene, 0, lights);
+            rtcUpdate(rtcLightScene, 0);
+            rtcCommit(rtcLightScene);
+        }
+    }
+
+    for (size_t i = 0; i < meshes.size(); ++i) {
+        Mesh& mesh = meshes[i];
+        Mesh& source = that.meshes[i];
+
+        if (changes & SceneChangeVertices && mesh.vertices != source.vertices) {
+            // Copied in place, compressed meshes share the buffer with Embree.
+            std::copy(source.vertices.begin(), source.vertices.end(), mesh.vertices.begin());
+
+            if (rtcScene && !rebuild) {
+                updateRTCVertices(rtcScene, unsigned(i + 1), mesh);
+                rtcUpdate(rtcScene, unsigned(i + 1));
+            }
+        }
+
+        if (changes & SceneChangeShading) {
+            mesh.materialID = source.materialID;
+            mesh.shading = move(source.shading);
+            mesh.packedNormals = move(source.packedNormals);
+            mesh.packedTangents = move(source.packedTangents);
+        }
+    }
+
+    if (changes & (SceneChangeLights | SceneChangeVertices)) {
+        _updateBounds();
+    }
+
+    if (rtcScene && rebuild) {
+        // The instanced scene references the light scene, it goes first.
+        rtcDeleteScene(rtcScene);
+        rtcScene = nullptr;
+        updateRTCLightScene(rtcLightScene, _device, *this, _dynamic);
+        buildAccelStructs(_device, _dynamic);
+    }
+    else if (rtcScene && (changes & (SceneChangeLights | SceneChangeVertices))) {
+        rtcCommit(rtcScene);
+    }
+}
+
+void Scene::_resolveInstance(RayIsect& isect) const {
+    if (isect.instID == lightInstanceID) {
+        isect.geomID = 0;
+    }
+    else if (isect.instID == staticInstanceID) {
+        isect.geomID += 1;
+    }
+    else {
+        const Instance& instance = instances[isect.instID - firstInstanceID];
+        isect.geomID = unsigned(instance.meshId + 1);
+        (vec3&)isect.Ng = instance.normalTransform * (vec3&)isect.Ng;
+    }
+}
+
+const Instance* Scene::_queryInstance(const RayIsect& isect) const {
+    if (!instances.empty() && isect.instID >= firstInstanceID) {
+        return &instances[isect.instID - firstInstanceID];
+    }
+    else {
+        return nullptr;
     }
 }
 
@@ -95,9 +647,26 @@ vec3 Scene::lerpNormal(const RayIsect& hit) const {
     const float w = 1.f - hit.u - hit.v;
     auto& mesh = meshes[hit.meshId()];
 
-    return w * mesh.normals[mesh.indices[hit.primID * 3 + 0]] +
-         hit.u * mesh.normals[mesh.indices[hit.primID * 3 + 1]] +
-         hit.v * mesh.normals[mesh.indices[hit.primID * 3 + 2]];
+    vec3 normal;
+
+    if (mesh.compressed) {
+        normal = w * decodeOctahedral(mesh.packedNormals[mesh.indices[hit.primID * 3 + 0]]) +
+             hit.u * decodeOctahedral(mesh.packedNormals[mesh.indices[hit.primID * 3 + 1]]) +
+             hit.v * decodeOctahedral(mesh.packedNormals[mesh.indices[hit.primID * 3 + 2]]);
+    }
+    else {
+        auto& shading = mesh.shading[hit.primID];
+
+        normal = w * shading.normals[0] +
+             hit.u * shading.normals[1] +
+             hit.v * shading.normals[2];
+    }
+
+    if (auto instance = _queryInstance(hit)) {
+        normal = instance->normalTransform * normal;
+    }
+
+    return normal;
 }
 
 SurfacePoint Scene::querySurface(const RayIsect& isect) const {
@@ -106,24 +675,45 @@ SurfacePoint Scene::querySurface(const RayIsect& isect) const {
     const float w = 1.f - isect.u - isect.v;
     auto& mesh = meshes[isect.meshId()];
 
-    SurfacePoint point;
-    point._position = (vec3&)isect.org + (vec3&)isect.dir * isect.tfar;
+    vec3 normal, tangent;
 
-    point._tangent[0] =
-        normalize(w * mesh.bitangents[mesh.indices[isect.primID * 3 + 0]] +
-        isect.u * mesh.bitangents[mesh.indices[isect.primID * 3 + 1]] +
-        isect.v * mesh.bitangents[mesh.indices[isect.primID * 3 + 2]]);
+    if (mesh.compressed) {
+        const int* indices = mesh.indices.data() + isect.primID * 3;
 
-    point._tangent[1] =
-        normalize(w * mesh.normals[mesh.indices[isect.primID * 3 + 0]] +
-        isect.u * mesh.normals[mesh.indices[isect.primID * 3 + 1]] +
-        isect.v * mesh.normals[mesh.indices[isect.primID * 3 + 2]]);
+        normal =
+            w * decodeOctahedral(mesh.packedNormals[indices[0]]) +
+            isect.u * decodeOctahedral(mesh.packedNormals[indices[1]]) +
+            isect.v * decodeOctahedral(mesh.packedNormals[indices[2]]);
 
-    point._tangent[2] =
-        normalize(w * mesh.tangents[mesh.indices[isect.primID * 3 + 0]] +
-        isect.u * mesh.tangents[mesh.indices[isect.primID * 3 + 1]] +
-        isect.v * mesh.tangents[mesh.indices[isect.primID * 3 + 2]]);
+        tangent =
+            w * decodeOctahedral(mesh.packedTangents[indices[0]]) +
+            isect.u * decodeOctahedral(mesh.packedTangents[indices[1]]) +
+            isect.v * decodeOctahedral(mesh.packedTangents[indices[2]]);
+    }
+    else {
+        auto& shading = mesh.shading[isect.primID];
+
+        normal =
+            w * shading.normals[0] +
+            isect.u * shading.normals[1] +
+            isect.v * shading.normals[2];
+
+        tangent =
+            w * shading.tangents[0] +
+            isect.u * shading.tangents[1] +
+            isect.v * shading.tangents[2];
+    }
 
+    if (auto instance = _queryInstance(isect)) {
+        normal = instance->normalTransform * normal;
+        tangent = mat3(instance->transform) * tangent;
+    }
+
+    SurfacePoint point;
+    point._position = (vec3&)isect.org + (vec3&)isect.dir * isect.tfar;
+    point._tangent[1] = normalize(normal);
+    point._tangent[2] = normalize(tangent);
+    point._tangent[0] = normalize(cross(point._tangent[1], point._tangent[2]));
     point._materialId = mesh.materialID;
 
     return point;
@@ -133,6 +723,59 @@ vec3 Scene::queryRadiance(const RayIsect& isect) const {
     return lights.lightRadiance(isect.primId());
 }
 
+vec3 Scene::queryEnvironment(const vec3& omega) const {
+    return environment.queryRadiance(omega);
+}
+
+const float Scene::_environmentPower() const {
+    return environment.empty()
+        ? 0.0f
+        : pi<float>() * _radius * _radius * environment.totalRadiance();
+}
+
+const float Scene::_environmentProbability() const {
+    return lights.numLights() == 0
+        ? 1.0f
+        : _environmentPower() / totalPower();
+}
+
+const vec3 Scene::_sampleEnvironmentDisk(
+    RandomEngine& engine,
+    const vec3& omega) const
+{
+    const vec3 axis = abs(omega.x) < 0.9f ? vec3(1.0f, 0.0f, 0.0f) : vec3(0.0f, 1.0f, 0.0f);
+    const vec3 u = normalize(cross(omega, axis));
+    const vec3 v = cross(omega, u);
+    const vec2 disk = sampleDisk1(engine).point() * _radius;
+
+    return _center + omega * _radius + u * disk.x + v * disk.y;
+}
+
+const float Scene::totalPower() const {
+    return lights.totalPower() + _environmentPower();
+}
+
+Photon Scene::emit(RandomEngine& engine) const {
+    const float environmentPower = _environmentPower();
+
+    if (lights.numLights() != 0 &&
+        sampleUniform1(engine).value() * totalPower() >= environmentPower) {
+        return lights.emit(engine);
+    }
+
+    // Photons from the environment enter through a disk covering the scene.
+    auto sample = environment.sample(engine);
+
+    Photon result;
+    result.position = _sampleEnvironmentDisk(engine, sample.omega());
+    result.direction = -sample.omega();
+    result.power = sample.radiance();
+    float length1 = 1.f / (result.power.x + result.power.y + result.power.z);
+    result.power = result.power * length1;
+
+    return result;
+}
+
 LightSample Scene::sampleLight(
     RandomEngine& engine,
     const vec3& position) const
@@ -144,7 +787,28 @@ LightSampleEx Scene::sampleLightEx(
     RandomEngine& engine,
     const vec3& position) const
 {
-    return lights.sampleEx(engine, position);
+    const float environmentProbability = _environmentProbability();
+
+    if (_environmentPower() == 0.0f ||
+        sampleUniform1(engine).value() >= environmentProbability) {
+        LightSampleEx result = lights.sampleEx(engine, position);
+        result._areaDensity *= 1.0f - environmentProbability;
+        return result;
+    }
+
+    auto sample = environment.sample(engine);
+    float distance = 2.0f * _radius + length(position - _center);
+
+    LightSampleEx result;
+    result._position = position + sample.omega() * distance;
+    result._normal = -sample.omega();
+    result._radiance = sample.radiance() * occluded(position, result._position);
+    result._omega = -sample.omega();
+    result._areaDensity = sample.density() * environmentProbability;
+    result._omegaDensity = one_over_pi<float>() / (_radius * _radius);
+    result._distant = true;
+
+    return result;
 }
 
 vec3 Scene::queryRadiance(
@@ -158,7 +822,48 @@ const LSDFQuery Scene::queryLSDF(
     const RayIsect& isect,
     const vec3& omega) const
 {
-    return lights.queryLSDF(isect.primId(), omega);
+    LSDFQuery result = lights.queryLSDF(isect.primId(), omega);
+    result._areaDensity *= 1.0f - _environmentProbability();
+    return result;
+}
+
+const LSDFQuery Scene::queryEnvironmentLSDF(const vec3& omega) const {
+    LSDFQuery result;
+    result._radiance = environment.queryRadiance(omega);
+    result._areaDensity = environment.density(omega) * _environmentProbability();
+    result._omegaDensity = one_over_pi<float>() / (_radius * _radius);
+    return result;
+}
+
+SurfaceFeatures Scene::queryFeatures(RandomEngine& engine, Ray ray) const {
+    static const size_t maxSpecularBounces = 8;
+
+    SurfaceFeatures features;
+    auto isect = intersect(ray);
+    size_t bounces = 0;
+
+    while (isect.isPresent()) {
+        features.depth += distance(ray.origin, isect.position());
+        ray.origin = isect.position();
+
+        if (!isect.isLight()) {
+            const SurfacePoint surface = querySurface(isect);
+            const BSDFSample sample = sampleBSDF(engine, surface, -ray.direction);
+
+            if (sample.specular() == 0.0f || bounces == maxSpecularBounces) {
+                features.albedo = materials.diffuses[surface.materialId()];
+                features.normal = surface.normal();
+                return features;
+            }
+
+            ray.direction = sample.omega();
+            ++bounces;
+        }
+
+        isect = intersect(ray);
+    }
+
+    return SurfaceFeatures();
 }
 
 const BSDFSample Scene::sampleBSDF(
@@ -210,6 +915,10 @@ const RayIsect Scene::intersect(
     rtcRay.time = 0.f;
     rtcIntersect(rtcScene, rtcRay);
 
+    if (!instances.empty() && rtcRay.isPresent()) {
+        _resolveInstance(rtcRay);
+    }
+
     ++_numIntersectRays;
 
     return rtcRay;
@@ -236,6 +945,55 @@ const float Scene::occluded(
     return rtcRay.geomID == 0 ? 0.f : 1.f;
 }
 
+void Scene::occluded(
+    float* visible,
+    const vec3* origins,
+    const vec3* targets,
+    size_t count) const
+{
+    size_t begin = 0;
+
+    for (; begin + 1 < count; begin += 4) {
+        const size_t size = std::min(count - begin, size_t(4));
+
+        alignas(16) int valid[4];
+        RTCRay4 rtcRay;
+
+        for (size_t i = 0; i < 4; ++i) {
+            // Inactive lanes repeat the last ray.
+            const size_t j = begin + std::min(i, size - 1);
+            const vec3 direction = targets[j] - origins[j];
+
+            valid[i] = i < size ? -1 : 0;
+            rtcRay.orgx[i] = origins[j].x;
+            rtcRay.orgy[i] = origins[j].y;
+            rtcRay.orgz[i] = origins[j].z;
+            rtcRay.dirx[i] = direction.x;
+            rtcRay.diry[i] = direction.y;
+            rtcRay.dirz[i] = direction.z;
+            rtcRay.tnear[i] = 0.00001f;
+            rtcRay.tfar[i] = 0.99999f;
+            rtcRay.time[i] = 0.f;
+            rtcRay.mask[i] = RayIsect::occluderMask();
+            rtcRay.geomID[i] = RTC_INVALID_GEOMETRY_ID;
+            rtcRay.primID[i] = RTC_INVALID_GEOMETRY_ID;
+            rtcRay.instID[i] = RTC_INVALID_GEOMETRY_ID;
+        }
+
+        rtcOccluded4(valid, rtcScene, rtcRay);
+
+        for (size_t i = 0; i < size; ++i) {
+            visible[begin + i] = rtcRay.geomID[i] == 0 ? 0.f : 1.f;
+        }
+
+        _numOccludedRays += size;
+    }
+
+    if (begin < count) {
+        visible[begin] = occluded(origins[begin], targets[begin]);
+    }
+}
+
 const RayIsect Scene::intersect(const Ray& ray) const {
     return intersect(ray.origin, ray.direction);
 }
@@ -254,7 +1012,7 @@ const RayIsect Scene::intersectLight(
     rtcRay.instID = RTC_INVALID_GEOMETRY_ID;
     rtcRay.mask = RayIsect::lightMask();
     rtcRay.time = 0.f;
-    rtcIntersect(rtcScene, rtcRay);
+    rtcIntersect(rtcLightScene, rtcRay);
 
     ++_numIntersectRays;
 
@@ -276,7 +1034,29 @@ const size_t Scene::numRays() const {
 const LightSampleEx Scene::sampleLight(
         RandomEngine& engine) const
 {
-    return lights.sample(engine);
+    const float environmentProbability = _environmentProbability();
+
+    if (_environmentPower() == 0.0f ||
+        sampleUniform1(engine).value() >= environmentProbability) {
+        LightSampleEx result = lights.sample(engine);
+        result._areaDensity *= 1.0f - environmentProbability;
+        return result;
+    }
+
+    // The same disk as in emit(), the direction plays the part of the
+    // position on a light and the disk the part of the direction.
+    auto sample = environment.sample(engine);
+
+    LightSampleEx result;
+    result._position = _sampleEnvironmentDisk(engine, sample.omega());
+    result._normal = -sample.omega();
+    result._radiance = sample.radiance();
+    result._omega = -sample.omega();
+    result._areaDensity = sample.density() * environmentProbability;
+    result._omegaDensity = one_over_pi<float>() / (_radius * _radius);
+    result._distant = true;
+
+    return result;
 }
 
 const vec3 Scene::sampleDirectLightAngle(
@@ -332,7 +1112,8 @@ const vec3 Scene::sampleDirectLightMixed(
     RandomEngine& engine,
     const SurfacePoint& surface,
     const vec3& omega,
-    const BSDF& bsdf) const
+    const BSDF& bsdf,
+    size_t numLightSamples) const
 {
     // sample BSDF
     auto bsdfSample = bsdf.sample(engine, surface, omega);
@@ -350,27 +1131,76 @@ const vec3 Scene::sampleDirectLightMixed(
         isect = intersect(isect.position(), bsdfSample.omega());
     }
 
+    vec3 environmentRadiance = environment.empty()
+        ? vec3(0.0f)
+        : _sampleEnvironmentMixed(
+            engine,
+            surface,
+            omega,
+            bsdf,
+            bsdfSample,
+            !isect.isPresent());
+
+    if (lights.numLights() == 0) {
+        return environmentRadiance;
+    }
+
     float bsdfDensity = bsdfSample.density();
 
-    // sample Light
-    LightSample lightSample = lights.sample(engine, surface.position());
-    float distSqInv = 1.0f / distance2(lightSample.position(), surface.position());
-    float fCosTheta = abs(dot(lightSample.omega(), lightSample.normal()));
-    float bCosTheta = abs(dot(lightSample.omega(), surface.normal()));
+    // sample Light, densities are scaled by the sample counts for MIS
+    const float numSamples = float(numLightSamples);
+    const size_t batchSize = 16;
 
-    vec3 lightRadiance =
-        lightSample.radiance() *
-        bsdf.query(surface, -lightSample.omega(), omega) *
-        bCosTheta;
+    vec3 lightThroughput = vec3(0.0f);
+
+    for (size_t batch = 0; batch < numLightSamples; batch += batchSize) {
+        vec3 throughputs[batchSize];
+        vec3 origins[batchSize];
+        vec3 targets[batchSize];
+        float visible[batchSize];
+        size_t count = 0;
+
+        for (size_t i = batch; i < std::min(batch + batchSize, numLightSamples); ++i) {
+            float uniform = (float(i) + sampleUniform1(engine).value()) / numSamples;
+
+            LightSample lightSample = lights.sampleUnoccluded(engine, surface.position(), uniform);
+            float distSqInv = 1.0f / distance2(lightSample.position(), surface.position());
+            float fCosTheta = abs(dot(lightSample.omega(), lightSample.normal()));
+            float bCosTheta = abs(dot(lightSample.omega(), surface.normal()));
+
+            vec3 lightRadiance =
+                lightSample.radiance() *
+                bsdf.query(surface, -lightSample.omega(), omega) *
+                bCosTheta;
 
-    float lightDensity = lightSample.density() / (fCosTheta * distSqInv);
+            if (lightRadiance == vec3(0.0f)) {
+                continue;
+            }
+
+            float lightDensity = lightSample.density() / (fCosTheta * distSqInv) * numSamples;
+            float bsdfDensity2 = bsdf.densityRev(surface, -lightSample.omega(), omega);
+
+            float lightWeight =
+                lightDensity * lightDensity /
+                (bsdfDensity2 * bsdfDensity2 + lightDensity * lightDensity);
+
+            throughputs[count] = lightRadiance / lightDensity * lightWeight;
+            origins[count] = lightSample.position();
+            targets[count] = surface.position();
+            ++count;
+        }
+
+        occluded(visible, origins, targets, count);
+
+        for (size_t i = 0; i < count; ++i) {
+            lightThroughput += throughputs[i] * visible[i];
+        }
+    }
 
     // combine
-    float bsdfDensity2 = bsdf.densityRev(surface, -lightSample.omega(), omega);
-    float lightDensity2 = lights.density(surface.position(), bsdfSample.omega());
+    float lightDensity2 = lights.density(surface.position(), bsdfSample.omega()) * numSamples;
 
     vec3 bsdfThroughput = bsdfRadiance / bsdfDensity;
-    vec3 lightThroughput = lightRadiance / lightDensity;
 
     // cutoff
 
@@ -397,13 +1227,161 @@ const vec3 Scene::sampleDirectLightMixed(
         bsdfDensity * bsdfDensity /
         (bsdfDensity * bsdfDensity + lightDensity2 * lightDensity2);
 
-    float lightWeight =
-        lightDensity * lightDensity /
-        (bsdfDensity2 * bsdfDensity2 + lightDensity * lightDensity);
-
     return
         bsdfThroughput * bsdfWeight +
-        lightThroughput * lightWeight;
+        lightThroughput +
+        environmentRadiance;
+}
+
+LightCandidate Scene::sampleLightCandidate(
+    RandomEngine& engine,
+    const vec3& position) const
+{
+    const float environmentProbability = _environmentProbability();
+
+    LightCandidate result;
+
+    if (sampleUniform1(engine).value() >= environmentProbability) {
+        auto sample = lights.sampleUnoccluded(engine, position);
+
+        result.position = sample.position();
+        result.normal = sample.normal();
+        result.radiance = sample.radiance();
+        result.density = sample.density() * (1.0f - environmentProbability);
+    }
+    else if (!environment.empty()) {
+        auto sample = environment.sample(engine);
+
+        result.position = sample.omega();
+        result.normal = -sample.omega();
+        result.radiance = sample.radiance();
+        result.density = sample.density() * environmentProbability;
+        result.distant = true;
+    }
+
+    return result;
+}
+
+const vec3 Scene::queryLightCandidate(
+    const SurfacePoint& surface,
+    const vec3& omega,
+    const BSDF& bsdf,
+    const LightCandidate& candidate) const
+{
+    if (candidate.distant) {
+        return
+            candidate.radiance *
+            bsdf.query(surface, candidate.position, omega) *
+            abs(dot(candidate.position, surface.normal()));
+    }
+
+    vec3 incident = candidate.position - surface.position();
+    float distSqInv = 1.0f / dot(incident, incident);
+    incident *= sqrt(distSqInv);
+
+    float fCosTheta = dot(-incident, candidate.normal);
+    float bCosTheta = abs(dot(incident, surface.normal()));
+
+    if (fCosTheta <= 0.0f) {
+        return vec3(0.0f);
+    }
+
+    return
+        candidate.radiance *
+        bsdf.query(surface, incident, omega) *
+        fCosTheta *
+        bCosTheta *
+        distSqInv;
+}
+
+const float Scene::occluded(
+    const SurfacePoint& surface,
+    const LightCandidate& candidate) const
+{
+    if (candidate.distant) {
+        float distance = 2.0f * _radius + length(surface.position() - _center);
+        return occluded(surface.position(), surface.position() + candidate.position * distance);
+    }
+
+    return occluded(surface.position(), candidate.position);
+}
+
+LightReservoir Scene::sampleLightReservoir(
+    RandomEngine& engine,
+    const SurfacePoint& surface,
+    const vec3& omega,
+    const BSDF& bsdf,
+    size_t numCandidates) const
+{
+    LightReservoir reservoir;
+
+    for (size_t i = 0; i < numCandidates; ++i) {
+        auto candidate = sampleLightCandidate(engine, surface.position());
+        vec3 contribution = queryLightCandidate(surface, omega, bsdf, candidate);
+        float target = contribution.x + contribution.y + contribution.z;
+        float weight = candidate.density > 0.0f ? target / candidate.density : 0.0f;
+
+        reservoir.update(
+            candidate,
+            target,
+            weight,
+            1.0f,
+            sampleUniform1(engine).value());
+    }
+
+    return reservoir;
+}
+
+const vec3 Scene::_sampleEnvironmentMixed(
+    RandomEngine& engine,
+    const SurfacePoint& surface,
+    const vec3& omega,
+    const BSDF& bsdf,
+    const BSDFSample& bsdfSample,
+    bool escaped) const
+{
+    vec3 radiance = vec3(0.0f);
+
+    // BSDF sample (shared with the area lights)
+    if (escaped) {
+        float bsdfDensity = bsdfSample.density();
+        float environmentDensity = environment.density(bsdfSample.omega());
+
+        float bsdfWeight =
+            bsdfDensity * bsdfDensity /
+            (bsdfDensity * bsdfDensity + environmentDensity * environmentDensity);
+
+        radiance +=
+            environment.queryRadiance(bsdfSample.omega()) *
+            bsdfSample.throughput() *
+            dot(bsdfSample.omega(), surface.gnormal()) /
+            bsdfDensity *
+            bsdfWeight;
+    }
+
+    // environment sample
+    auto sample = environment.sample(engine);
+
+    float distance = 2.0f * _radius + length(surface.position() - _center);
+    float visible = occluded(surface.position(), surface.position() + sample.omega() * distance);
+    float bCosTheta = abs(dot(sample.omega(), surface.normal()));
+
+    float environmentDensity = sample.density();
+    float bsdfDensity = bsdf.densityRev(surface, sample.omega(), omega);
+
+    float environmentWeight =
+        environmentDensity * environmentDensity /
+        (bsdfDensity * bsdfDensity + environmentDensity * environmentDensity);
+
+    radiance +=
+        sample.radiance() *
+        bsdf.query(surface, sample.omega(), omega) *
+        bCosTheta *
+        visible /
+        environmentDensity *
+        environmentWeight;
+
+    return radiance;
 }
 
 }
@@ -4,6 +4,7 @@
 
 #include <BSDF.hpp>
 #include <AreaLights.hpp>
+#include <EnvironmentLight.hpp>
 #include <Materials.hpp>
 #include <Cameras.hpp>
 
@@ -23,14 +24,88 @@ using std::move;
 
 struct Ray;
 
+struct TriangleShading {
+    vec3 normals[3];
+    vec3 tangents[3];
+};
+
 struct Mesh {
     string name;
     unsigned materialID;
     vector<int> indices;
-    vector<vec3> vertices;
-    vector<vec3> normals;
+    vector<vec3> vertices; // padded by one if compressed, see compressShading
+    vector<vec3> normals; // per vertex, released once Scene built the records
     vector<vec3> tangents;
     vector<vec3> bitangents;
+    vector<TriangleShading> shading; // indexed by primID, built by Scene
+    vector<uint32_t> packedNormals; // octahedral, compressed meshes only
+    vector<uint32_t> packedTangents;
+    bool compressed = false;
+    bool instanced = false; // object space, referenced by Scene::instances
+};
+
+struct Instance {
+    size_t meshId;
+    mat4 transform;
+    mat3 normalTransform; // built by Scene
+};
+
+enum SceneChange : unsigned {
+    SceneChangeNone = 0,
+    SceneChangeCameras = 1,
+    SceneChangeMaterials = 2,
+    SceneChangeLights = 4,
+    SceneChangeShading = 8,
+    SceneChangeVertices = 16,
+    SceneChangeTopology = 32
+};
+
+// Light sample without visibility, resampled by LightReservoir.
+struct LightCandidate {
+    vec3 position; // direction towards the light if distant
+    vec3 normal;
+    vec3 radiance;
+    float density = 0.0f; // per area, per solid angle if distant
+    bool distant = false;
+};
+
+// Weighted reservoir sampling of light candidates (ReSTIR).
+struct LightReservoir {
+    LightCandidate candidate;
+    float target = 0.0f; // target function of the candidate at the owner
+    float weightSum = 0.0f;
+    float count = 0.0f; // number of candidates seen
+
+    bool update(
+        const LightCandidate& that,
+        float thatTarget,
+        float weight,
+        float thatCount,
+        float uniform)
+    {
+        weightSum += weight;
+        count += thatCount;
+
+        if (weight > 0.0f && uniform * weightSum < weight) {
+            candidate = that;
+            target = thatTarget;
+            return true;
+        }
+
+        return false;
+    }
+
+    // Contribution weight of the candidate (W).
+    const float weight() const {
+        return target > 0.0f ? weightSum / (count * target) : 0.0f;
+    }
+};
+
+// Auxiliary outputs (AOVs) of the first non-specular surface seen by a ray.
+struct SurfaceFeatures {
+    vec3 albedo = vec3(0.0f);
+    vec3 normal = vec3(0.0f);
+    float depth = 0.0f; // distance along the (possibly reflected) ray
 };
 
 class Scene : public Intersector {
@@ -39,16 +114,30 @@ public:
         Cameras&& cameras,
         Materials&& materials,
         vector<Mesh>&& meshes,
-        AreaLights&& areaLights);
+        vector<Instance>&& instances,
+        AreaLights&& areaLights,
+        bool compressMeshes = false);
+
+    ~Scene();
 
     Cameras _cameras;
-    const vector<Mesh> meshes;
+    vector<Mesh> meshes;
+    const vector<Instance> instances;
     AreaLights lights;
-    const Materials materials;
+    EnvironmentLight environment;
+    Materials materials;
 
     const Cameras& cameras() const { return _cameras; }
 
-    void buildAccelStructs(RTCDevice device);
+    // Dynamic scenes can refit moved vertices and lights in update().
+    void buildAccelStructs(RTCDevice device, bool dynamic = false);
+
+    // Returns SceneChange flags describing how that differs from this.
+    unsigned diff(const Scene& that) const;
+
+    // Takes over the changed parts of that, changes cannot contain
+    // SceneChangeTopology. Must not run concurrently with rendering.
+    void update(Scene&& that, unsigned changes);
 
     const BSDF& queryBSDF(const RayIsect& isect) const;
     vec3 lightExitance(const RayIsect& hit) const;
@@ -57,10 +146,19 @@ public:
     vec3 queryRadiance(const RayIsect& isect) const;
     SurfacePoint querySurface(const RayIsect& isect) const;
 
+    // Radiance arriving along -omega from rays leaving the scene.
+    vec3 queryEnvironment(const vec3& omega) const;
+
+    // Emits from the area lights and the environment proportionally to power.
+    Photon emit(RandomEngine& engine) const;
+    const float totalPower() const;
+
     LightSample sampleLight(
         RandomEngine& engine,
         const vec3& position) const;
 
+    // Picks the environment proportionally to power, its samples are
+    // distant and their area density is the density of the direction.
     LightSampleEx sampleLightEx(
         RandomEngine& engine,
         const vec3& position) const;
@@ -73,6 +171,9 @@ public:
         const RayIsect& isect,
         const vec3& omega) const;
 
+    // Densities of the environment along omega, for rays leaving the scene.
+    const LSDFQuery queryEnvironmentLSDF(const vec3& omega) const;
+
     const RayIsect intersect(
         const vec3& origin,
         const vec3& direction) const override;
@@ -83,6 +184,13 @@ public:
     const float occluded(const vec3& origin,
         const vec3& target) const override;
 
+    // Traces count shadow rays in packets, visible[i] is 0 or 1.
+    void occluded(
+        float* visible,
+        const vec3* origins,
+        const vec3* targets,
+        size_t count) const;
+
     const RayIsect intersectLight(
         const vec3& origin,
         const vec3& direction) const override;
@@ -91,8 +199,8 @@ public:
     const size_t numShadowRays() const;
     const size_t numRays() const;
 
-    mutable UniformSampler sampler;
-
+    // Starts light subpaths on the area lights or, proportionally to power,
+    // on the disk through which the environment enters the scene.
     const LightSampleEx sampleLight(
         RandomEngine& engine) const;
 
@@ -123,17 +231,73 @@ public:
         const vec3& omegaR,
         const BSDF& bsdf) const;
 
+    // Combines one BSDF sample with numLightSamples stratified light
+    // samples, the shadow rays of the light samples are traced together.
     const vec3 sampleDirectLightMixed(
         RandomEngine& engine,
         const SurfacePoint& surface,
         const vec3& omega,
-        const BSDF& bsdf) const;
+        const BSDF& bsdf,
+        size_t numLightSamples = 1) const;
+
+    // Area lights and the environment are picked proportionally to power.
+    LightCandidate sampleLightCandidate(
+        RandomEngine& engine,
+        const vec3& position) const;
+
+    // Unoccluded contribution with respect to the measure of the candidate.
+    const vec3 queryLightCandidate(
+        const SurfacePoint& surface,
+        const vec3& omega,
+        const BSDF& bsdf,
+        const LightCandidate& candidate) const;
+
+    const float occluded(
+        const SurfacePoint& surface,
+        const LightCandidate& candidate) const;
+
+    // Resamples numCandidates light candidates, no shadow rays are traced.
+    LightReservoir sampleLightReservoir(
+        RandomEngine& engine,
+        const SurfacePoint& surface,
+        const vec3& omega,
+        const BSDF& bsdf,
+        size_t numCandidates) const;
+
+    // Looks through lights and up to a few specular surfaces, the features
+    // are zero if the ray leaves the scene.
+    SurfaceFeatures queryFeatures(RandomEngine& engine, Ray ray) const;
 
 private:
     mutable std::atomic<size_t> _numIntersectRays;
     mutable std::atomic<size_t> _numOccludedRays;
 
     mutable RTCScene rtcScene;
+    mutable RTCScene rtcLightScene;
+    mutable vector<RTCScene> rtcPrototypes;
+    RTCDevice _device = nullptr;
+    bool _dynamic = false;
+
+    // Bounding sphere, the environment is emitted from its outside.
+    vec3 _center;
+    float _radius;
+
+    void _updateBounds();
+    const float _environmentPower() const;
+    const float _environmentProbability() const;
+    const vec3 _sampleEnvironmentDisk(
+        RandomEngine& engine,
+        const vec3& omega) const;
+    const vec3 _sampleEnvironmentMixed(
+        RandomEngine& engine,
+        const SurfacePoint& surface,
+        const vec3& omega,
+        const BSDF& bsdf,
+        const BSDFSample& bsdfSample,
+        bool escaped) const;
+
+    void _resolveInstance(RayIsect& isect) const;
+    const Instance* _queryInstance(const RayIsect& isect) const;
 };
 
 }
@@ -0,0 +1,313 @@
+#include <runtime_assert>
+#include <SceneCache.hpp>
+#include <cstring>
+#include <sys/stat.h>
+
+namespace haste {
+
+//
+// Cache layout, integers are uint64 in native byte order unless noted.
+//
+// header: magic "HSTC", uint32 version, source mtime (ns), source size,
+//     dependencies: count, { path, mtime, size }
+// cameras: count, { name, position, direction, up, fovx, near, far }
+// materials: count, { name, diffuse, specular, uint32 bsdf, ior }
+// meshes: count, { name, uint32 materialID, uint32 instanced,
+//     indices, vertices, normals, tangents, bitangents }
+// instances: count, { meshId, transform }
+// lights: names: count, { name },
+//     count, { uint32 name index, uint32 triangle, exitance,
+//     triangle ? v0, v1, v2 : position, direction, up, size }
+//
+// Strings and arrays are written by BinaryWriter.
+//
+
+static const char cacheMagic[4] = { 'H', 'S', 'T', 'C' };
+static const uint32_t cacheVersion = 7;
+
+// Seconds alone miss edits saved within the same second.
+struct SourceStamp {
+    std::uint64_t mtime = 0; // nanoseconds
+    std::uint64_t size = 0;
+};
+
+bool sourceStamp(SourceStamp& stamp, const string& path) {
+    struct stat buf;
+
+    if (stat(path.c_str(), &buf) != 0) {
+        return false;
+    }
+
+    stamp.mtime =
+        std::uint64_t(buf.st_mtim.tv_sec) * 1000000000u +
+        std::uint64_t(buf.st_mtim.tv_nsec);
+    stamp.size = std::uint64_t(buf.st_size);
+    return true;
+}
+
+bool operator==(const SourceStamp& a, const SourceStamp& b) {
+    return a.mtime == b.mtime && a.size == b.size;
+}
+
+// Missing dependencies are stamped as zeros, creating them invalidates
+// the cache as well.
+SourceStamp dependencyStamp(const string& path) {
+    SourceStamp stamp;
+    sourceStamp(stamp, path);
+    return stamp;
+}
+
+string sceneCachePath(const string& source) {
+    return source + ".cache";
+}
+
+bool readSceneDesc(SceneDesc& desc, BinaryReader& reader) {
+    std::uint64_t numCameras = reader.pod<std::uint64_t>();
+
+    for (size_t i = 0; i < numCameras && reader.good(); ++i) {
+        string name = reader.str();
+        vec3 position = reader.pod<vec3>();
+        vec3 direction = reader.pod<vec3>();
+        vec3 up = reader.pod<vec3>();
+        float fovx = reader.pod<float>();
+        float near = reader.pod<float>();
+        float far = reader.pod<float>();
+
+        desc.cameras.addCameraFovX(name, position, direction, up, fovx, near, far);
+    }
+
+    std::uint64_t numMaterials = reader.pod<std::uint64_t>();
+
+    for (size_t i = 0; i < numMaterials && reader.good(); ++i) {
+        MaterialDesc material;
+        material.name = reader.str();
+        material.diffuse = reader.pod<vec3>();
+        material.specular = reader.pod<vec3>();
+        material.bsdf = MaterialBSDF(reader.pod<uint32_t>());
+        material.ior = reader.pod<float>();
+        desc.materials.push_back(material);
+    }
+
+    std::uint64_t numMeshes = reader.pod<std::uint64_t>();
+
+    for (size_t i = 0; i < numMeshes && reader.good(); ++i) {
+        Mesh mesh;
+        mesh.name = reader.str();
+        mesh.materialID = reader.pod<uint32_t>();
+        mesh.instanced = reader.pod<uint32_t>() != 0;
+        reader.array(mesh.indices);
+        reader.array(mesh.vertices);
+        reader.array(mesh.normals);
+        reader.array(mesh.tangents);
+        reader.array(mesh.bitangents);
+        desc.meshes.push_back(move(mesh));
+    }
+
+    std::uint64_t numInstances = reader.pod<std::uint64_t>();
+
+    for (size_t i = 0; i < numInstances && reader.good(); ++i) {
+        Instance instance;
+        instance.meshId = size_t(reader.pod<std::uint64_t>());
+        instance.transform = reader.pod<mat4>();
+        desc.instances.push_back(instance);
+    }
+
+    // One name per emissive mesh, not per triangle.
+    std::uint64_t numNames = reader.pod<std::uint64_t>();
+    vector<string> names;
+
+    for (size_t i = 0; i < numNames && reader.good(); ++i) {
+        names.push_back(reader.str());
+    }
+
+    std::uint64_t numLights = reader.pod<std::uint64_t>();
+
+    for (size_t i = 0; i < numLights && reader.good(); ++i) {
+        uint32_t nameIndex = reader.pod<uint32_t>();
+
+        if (nameIndex >= names.size()) {
+            return false;
+        }
+
+        const string& name = names[nameIndex];
+        bool triangle = reader.pod<uint32_t>() != 0;
+        vec3 exitance = reader.pod<vec3>();
+
+        if (triangle) {
+            vec3 v0 = reader.pod<vec3>();
+            vec3 v1 = reader.pod<vec3>();
+            vec3 v2 = reader.pod<vec3>();
+
+            desc.lights.addLight(name, v0, v1, v2, exitance);
+        }
+        else {
+            vec3 position = reader.pod<vec3>();
+            vec3 direction = reader.pod<vec3>();
+            vec3 up = reader.pod<vec3>();
+            vec2 size = reader.pod<vec2>();
+
+            desc.lights.addLight(name, position, direction, up, exitance, size);
+        }
+    }
+
+    return reader.good();
+}
+
+bool readSceneCache(SceneDesc& desc, const string& source) {
+    SourceStamp stamp;
+
+    if (!sourceStamp(stamp, source)) {
+        return false;
+    }
+
+    MappedFile file(sceneCachePath(source));
+
+    if (file.data() == nullptr) {
+        return false;
+    }
+
+    BinaryReader reader(file.data(), file.data() + file.size());
+
+    char magic[4];
+    reader.raw(magic, 4);
+
+    bool valid = std::memcmp(magic, cacheMagic, 4) == 0
+        && reader.pod<uint32_t>() == cacheVersion
+        && reader.pod<std::uint64_t>() == stamp.mtime
+        && reader.pod<std::uint64_t>() == stamp.size;
+
+    std::uint64_t numDependencies = valid ? reader.pod<std::uint64_t>() : 0;
+
+    for (size_t i = 0; i < numDependencies && valid && reader.good(); ++i) {
+        string path = reader.str();
+        SourceStamp dependency;
+        dependency.mtime = reader.pod<std::uint64_t>();
+        dependency.size = reader.pod<std::uint64_t>();
+
+        valid = dependency == dependencyStamp(path);
+        desc.dependencies.push_back(path);
+    }
+
+    valid = valid && reader.good() && readSceneDesc(desc, reader);
+
+    if (!valid) {
+        desc = SceneDesc();
+    }
+
+    return valid;
+}
+
+// Dependencies are stamped up front, so both passes write the same.
+static void writeSceneCache(
+    BinaryWriter& writer,
+    const SourceStamp& stamp,
+    const vector<SourceStamp>& dependencies,
+    const SceneDesc& desc)
+{
+    writer.raw(cacheMagic, 4);
+    writer.pod(cacheVersion);
+    writer.pod(stamp.mtime);
+    writer.pod(stamp.size);
+    writer.pod(std::uint64_t(desc.dependencies.size()));
+
+    for (size_t i = 0; i < desc.dependencies.size(); ++i) {
+        writer.str(desc.dependencies[i]);
+        writer.pod(dependencies[i].mtime);
+        writer.pod(dependencies[i].size);
+    }
+
+    const Cameras& cameras = desc.cameras;
+    writer.pod(std::uint64_t(cameras.numCameras()));
+
+    for (size_t i = 0; i < cameras.numCameras(); ++i) {
+        writer.str(cameras.name(i));
+        writer.pod(cameras.position(i));
+        writer.pod(cameras.direction(i));
+        writer.pod(cameras.up(i));
+        writer.pod(cameras.fovx(i, 1.0f));
+        writer.pod(cameras.near(i));
+        writer.pod(cameras.far(i));
+    }
+
+    writer.pod(std::uint64_t(desc.materials.size()));
+
+    for (auto&& material : desc.materials) {
+        writer.str(material.name);
+        writer.pod(material.diffuse);
+        writer.pod(material.specular);
+        writer.pod(uint32_t(material.bsdf));
+        writer.pod(material.ior);
+    }
+
+    writer.pod(std::uint64_t(desc.meshes.size()));
+
+    for (auto&& mesh : desc.meshes) {
+        writer.str(mesh.name);
+        writer.pod(uint32_t(mesh.materialID));
+        writer.pod(uint32_t(mesh.instanced));
+        writer.array(mesh.indices);
+        writer.array(mesh.vertices);
+        writer.array(mesh.normals);
+        writer.array(mesh.tangents);
+        writer.array(mesh.bitangents);
+    }
+
+    writer.pod(std::uint64_t(desc.instances.size()));
+
+    for (auto&& instance : desc.instances) {
+        writer.pod(std::uint64_t(instance.meshId));
+        writer.pod(instance.transform);
+    }
+
+    const AreaLights& lights = desc.lights;
+    writer.pod(std::uint64_t(lights._names.size()));
+
+    for (auto&& name : lights._names) {
+        writer.str(name);
+    }
+
+    writer.pod(std::uint64_t(lights.numLights()));
+
+    for (size_t i = 0; i < lights.numLights(); ++i) {
+        writer.pod(lights._sources[i]);
+        writer.pod(uint32_t(lights.isTriangle(i)));
+        writer.pod(lights._exitances[i]);
+
+        if (lights.isTriangle(i)) {
+            writer.pod(lights._corners[i * 4 + 0]);
+            writer.pod(lights._corners[i * 4 + 1]);
+            writer.pod(lights._corners[i * 4 + 2]);
+        }
+        else {
+            writer.pod(lights._shapes[i].position);
+            writer.pod(lights._shapes[i].direction);
+            writer.pod(lights._shapes[i].up);
+            writer.pod(lights._sizes[i]);
+        }
+    }
+}
+
+void writeSceneCache(const string& source, const SceneDesc& desc) {
+    SourceStamp stamp;
+
+    if (!sourceStamp(stamp, source)) {
+        return;
+    }
+
+    vector<SourceStamp> dependencies;
+
+    for (auto&& path : desc.dependencies) {
+        dependencies.push_back(dependencyStamp(path));
+    }
+
+    // The first pass only measures the file.
+    BinaryWriter measure;
+    writeSceneCache(measure, stamp, dependencies, desc);
+
+    writeMappedFile(sceneCachePath(source), measure.size(), [&](char* data) {
+        BinaryWriter writer(data);
+        writeSceneCache(writer, stamp, dependencies, desc);
+    });
+}
+
+}
@@ -0,0 +1,38 @@
+#pragma once
+#include <Scene.hpp>
+
+namespace haste {
+
+enum MaterialBSDF : unsigned {
+    MaterialBSDFDiffuse,
+    MaterialBSDFReflection,
+    MaterialBSDFTransmission
+};
+
+struct MaterialDesc {
+    string name;
+    vec3 diffuse;
+    vec3 specular;
+    MaterialBSDF bsdf;
+    float ior;
+};
+
+// Imported scene before it is turned into a Scene (meshes without shading
+// records, materials without BSDF instances).
+struct SceneDesc {
+    Cameras cameras;
+    vector<MaterialDesc> materials;
+    vector<Mesh> meshes;
+    vector<Instance> instances;
+    AreaLights lights;
+    vector<string> dependencies; // files read besides the source (mtllibs)
+};
+
+string sceneCachePath(const string& source);
+
+// Returns false if the cache doesn't exist or is older than the source or
+// any of its dependencies.
+bool readSceneCache(SceneDesc& desc, const string& source);
+void writeSceneCache(const string& source, const SceneDesc& desc);
+
+}
@@ -1,16 +1,61 @@
 #include <runtime_assert>
-#include <GLFW/glfw3.h>
 #include <Technique.hpp>
+#include <cstring>
 
 #include <tbb/parallel_for.h>
+#include <tbb/parallel_reduce.h>
 #include <tbb/blocked_range.h>
 
 namespace haste {
 
-Technique::Technique() { }
+Technique::Technique() : _interrupt(false) { }
 
 Technique::~Technique() { }
 
+// Sum of the pixel estimates and their count, joined by parallel_reduce.
+struct MeanSum {
+    double sum = 0.0;
+    size_t count = 0;
+};
+
+static MeanSum imageSum(const ImageView& view, size_t yBegin, size_t yEnd, MeanSum result) {
+    for (size_t y = yBegin; y < yEnd; ++y) {
+        for (size_t x = view.xBegin(); x < view.xEnd(); ++x) {
+            const vec4& pixel = view.absAt(x, y);
+
+            if (pixel.w != 0.0f) {
+                result.sum += (pixel.x + pixel.y + pixel.z) / pixel.w;
+                ++result.count;
+            }
+        }
+    }
+
+    return result;
+}
+
+float imageMean(const ImageView& view, bool parallel) {
+    MeanSum result;
+
+    if (parallel) {
+        result = tbb::parallel_reduce(
+            tbb::blocked_range<size_t>(view.yBegin(), view.yEnd()),
+            MeanSum(),
+            [&](const tbb::blocked_range<size_t>& range, MeanSum result) {
+                return imageSum(view, range.begin(), range.end(), result);
+            },
+            [](MeanSum a, const MeanSum& b) {
+                a.sum += b.sum;
+                a.count += b.count;
+                return a;
+            });
+    }
+    else {
+        result = imageSum(view, view.yBegin(), view.yEnd(), result);
+    }
+
+    return result.count == 0 ? 0.0f : float(result.sum / double(result.count));
+}
+
 void Technique::preprocess(
     const shared<const Scene>& scene,
     RandomEngine& engine,
@@ -23,6 +68,33 @@ void Technique::preprocess(
     _scene = scene;
 }
 
+void Technique::saveState(vector<char>& state) const {
+    const std::uint64_t counters[2] = { _numNormalRays, _numShadowRays };
+    state.assign((const char*)counters, (const char*)counters + sizeof(counters));
+}
+
+bool Technique::loadState(const vector<char>& state) {
+    std::uint64_t counters[2];
+
+    if (state.size() != sizeof(counters)) {
+        return false;
+    }
+
+    std::memcpy(counters, state.data(), sizeof(counters));
+    _numNormalRays = size_t(counters[0]);
+    _numShadowRays = size_t(counters[1]);
+
+    return true;
+}
+
+void Technique::interrupt() {
+    _interrupt = true;
+}
+
+void Technique::resume() {
+    _interrupt = false;
+}
+
 void Technique::render(
     ImageView& view,
     RandomEngine& engine,
@@ -32,32 +104,88 @@ void Technique::render(
     size_t numNormalRays = _scene->numNormalRays();
     size_t numShadowRays = _scene->numShadowRays();
 
+    _imageMean = imageMean(view, parallel);
+
+    const bool completed = _renderPass(view, engine, cameraId, parallel);
+
+    _numNormalRays += _scene->numNormalRays() - numNormalRays;
+    _numShadowRays += _scene->numShadowRays() - numShadowRays;
+    _interrupted = !completed;
+
+    if (!_interrupted) {
+        _numSamples = size_t(view.last().w);
+    }
+}
+
+bool Technique::_renderPass(
+    ImageView& view,
+    RandomEngine& engine,
+    size_t cameraId,
+    bool parallel)
+{
+    return _forEachTile(view, engine, parallel, [&](ImageView& tile, RandomEngine& engine) {
+        render(tile, engine, cameraId);
+    });
+}
+
+bool Technique::_forEachTile(
+    ImageView& view,
+    RandomEngine& engine,
+    bool parallel,
+    const function<void(ImageView&, RandomEngine&)>& func)
+{
+    // Tiles check for interruption before they start, tiles in flight run
+    // to completion, so every pixel gets either a whole sample or none.
+    std::atomic<bool> interrupted(false);
+
     if (parallel) {
-        static const size_t batch = 64;
-        auto range = tbb::blocked_range<size_t>(0, (view.yWindow() + batch - 1) / batch);
+        // Square tiles, so even a band of a single tile row is parallel.
+        static const size_t tile = 64;
+        const size_t numXTiles = (view.xWindow() + tile - 1) / tile;
+        const size_t numYTiles = (view.yWindow() + tile - 1) / tile;
+        const size_t numTiles = numXTiles * numYTiles;
+        auto range = tbb::blocked_range<size_t>(0, numTiles);
+
+        // Every tile gets its own engine, seeded independently of scheduling.
+        vector<uint32_t> seeds(numTiles);
+
+        for (auto& seed : seeds) {
+            seed = engine.seed();
+        }
 
         parallel_for(range, [&](const tbb::blocked_range<size_t>& range) {
-            RandomEngine engine;
+            for (size_t i = range.begin(); i < range.end(); ++i) {
+                if (_interrupt) {
+                    interrupted = true;
+                    return;
+                }
 
-            ImageView subview = view;
+                RandomEngine engine(seeds[i]);
 
-            size_t yBegin = view._yOffset + batch * range.begin();
-            size_t yEnd = yBegin + (range.end() - range.begin()) * batch;
-            yEnd = min(yEnd, view.yEnd());
+                ImageView subview = view;
 
-            subview._yOffset = yBegin;
-            subview._yWindow = yEnd - yBegin;
+                size_t xBegin = view.xBegin() + tile * (i % numXTiles);
+                size_t xEnd = min(xBegin + tile, view.xEnd());
+                size_t yBegin = view.yBegin() + tile * (i / numXTiles);
+                size_t yEnd = min(yBegin + tile, view.yEnd());
 
-            render(subview, engine, cameraId);
+                subview._xOffset = xBegin;
+                subview._xWindow = xEnd - xBegin;
+                subview._yOffset = yBegin;
+                subview._yWindow = yEnd - yBegin;
+
+                func(subview, engine);
+            }
         });
     }
+    else if (!_interrupt) {
+        func(view, engine);
+    }
     else {
-        render(view, engine, cameraId);
+        interrupted = true;
     }
 
-    _numNormalRays += _scene->numNormalRays() - numNormalRays;
-    _numShadowRays += _scene->numShadowRays() - numShadowRays;
-    _numSamples = size_t(view.last().w);
+    return !interrupted;
 }
 
 void Technique::render(
@@ -65,16 +193,53 @@ void Technique::render(
     RandomEngine& engine,
     size_t cameraId)
 {
-     auto trace = [&](RandomEngine& engine, Ray ray) -> vec3 {
-        return _trace(engine, ray);
+     auto trace = [&](RandomEngine& engine, Ray ray, float scale) -> vec3 {
+        return _trace(engine, ray, scale);
     };
 
     for_each_ray(view, engine, _scene->cameras(), cameraId, trace);
 }
 
+// Hashes the pixel and the number of its feature samples, neighbouring
+// seeds of the linear congruential engine give correlated streams.
+static std::uint32_t featureSeed(size_t pixel, float count) {
+    std::uint32_t seed = std::uint32_t(pixel) * 2654435761u ^ std::uint32_t(count) * 2246822519u;
+    seed ^= seed >> 15;
+    seed *= 2246822519u;
+    seed ^= seed >> 13;
+    return seed;
+}
+
+void Technique::_accumulateFeatures(
+    ImageView& view,
+    const Ray& ray,
+    size_t x,
+    size_t y)
+{
+    RandomEngine engine(featureSeed(y * view.width() + x, view.albedoAt(x, y).w));
+    const SurfaceFeatures features = _scene->queryFeatures(engine, ray);
+
+    view.albedoAt(x, y) += vec4(features.albedo, 1.0f);
+    view.normalAt(x, y) += vec4(features.normal, features.depth);
+}
+
+void Technique::_accumulateMoments(
+    ImageView& view,
+    const vec3& radiance,
+    size_t x,
+    size_t y)
+{
+    float intensity = (radiance.x + radiance.y + radiance.z) / 3.0f;
+
+    if (view._moments != nullptr && std::isfinite(intensity)) {
+        view.momentsAt(x, y) += intensity * intensity;
+    }
+}
+
 vec3 Technique::_trace(
     RandomEngine& engine,
-    const Ray& ray)
+    const Ray& ray,
+    float scale)
 {
     return vec3(1.0f, 0.0f, 1.0f);
 }
@@ -5,6 +5,7 @@
 #include <Prerequisites.hpp>
 #include <ImageView.hpp>
 #include <Scene.hpp>
+#include <Roulette.hpp>
 
 namespace haste {
 
@@ -32,11 +33,26 @@ public:
 
     virtual string name() const = 0;
 
+    // State of a progressive render besides the image, for checkpoints.
+    // Restored after preprocess(), returns false if it doesn't fit.
+    virtual void saveState(vector<char>& state) const;
+    virtual bool loadState(const vector<char>& state);
+
     const size_t numNormalRays() const { return _numNormalRays; }
     const size_t numShadowRays() const { return _numShadowRays; }
     const size_t numSamples() const { return _numSamples; }
 
-    template <class F> static void for_each_ray(
+    // Makes the pass in flight skip the tiles which haven't started yet,
+    // safe to call from any thread. Holds until resume() is called.
+    void interrupt();
+    void resume();
+
+    // Whether the last pass was cut short, its skipped tiles didn't
+    // contribute and it isn't counted in numSamples().
+    const bool interrupted() const { return _interrupted; }
+
+    // Calls func(engine, ray, scale), see Roulette::pixelScale.
+    template <class F> void for_each_ray(
         ImageView& view,
         RandomEngine& engine,
         const Cameras& cameras,
@@ -54,10 +70,47 @@ protected:
     size_t _numShadowRays;
     size_t _numSamples;
     shared<const Scene> _scene;
+    float _imageMean = 0.0f;
+    std::atomic<bool> _interrupt;
+    bool _interrupted = false;
 
     virtual vec3 _trace(
         RandomEngine& engine,
-        const Ray& ray);
+        const Ray& ray,
+        float scale);
+
+    // Renders a sample per pixel of the view, returns false if the pass was
+    // interrupted. Calls render(tile, engine, cameraId) for every tile.
+    virtual bool _renderPass(
+        ImageView& view,
+        RandomEngine& engine,
+        size_t cameraId,
+        bool parallel);
+
+    // Calls func(tile, engine) for the tiles of the view (the whole view if
+    // not parallel), every tile with its own engine. Returns false if some
+    // tiles were skipped because of an interrupt.
+    bool _forEachTile(
+        ImageView& view,
+        RandomEngine& engine,
+        bool parallel,
+        const function<void(ImageView&, RandomEngine&)>& func);
+
+    // Adds a sample of Scene::queryFeatures to the feature buffers. Features
+    // draw from their own stream, the radiance doesn't depend on them.
+    void _accumulateFeatures(
+        ImageView& view,
+        const Ray& ray,
+        size_t x,
+        size_t y);
+
+    // Adds the squared intensity of a radiance sample to the moments, which
+    // give the variance of the pixel for the denoiser.
+    void _accumulateMoments(
+        ImageView& view,
+        const vec3& radiance,
+        size_t x,
+        size_t y);
 
 private:
     Technique(const Technique&) = delete;
@@ -101,9 +154,14 @@ template <class F> inline void Technique::for_each_ray(
     for (int y = yBegin; y < yEnd; ++y) {
         for (int x = xBegin; x < xEnd; ++x) {
             const Ray ray = shoot(float(x), float(y));
-            vec3 radiance = func(engine, ray);
+            vec3 radiance = func(engine, ray, Roulette::pixelScale(view.absAt(x, y), _imageMean));
             float cumulative = radiance.x + radiance.y + radiance.z;
             view.absAt(x, y) += std::isfinite(cumulative) ? vec4(radiance, 1.0f) : vec4(0.0f);
+
+            if (view.hasFeatures()) {
+                _accumulateFeatures(view, ray, x, y);
+                _accumulateMoments(view, radiance, x, y);
+            }
         }
 
         ++y;
@@ -111,9 +169,14 @@ template <class F> inline void Technique::for_each_ray(
         if (y < yEnd) {
             for (int x = rXBegin; x > rXEnd; --x) {
                 const Ray ray = shoot(float(x), float(y));
-                vec3 radiance = func(engine, ray);
+                vec3 radiance = func(engine, ray, Roulette::pixelScale(view.absAt(x, y), _imageMean));
                 float cumulative = radiance.x + radiance.y + radiance.z;
                 view.absAt(x, y) += std::isfinite(cumulative) ? vec4(radiance, 1.0f) : vec4(0.0f);
+
+                if (view.hasFeatures()) {
+                    _accumulateFeatures(view, ray, x, y);
+                    _accumulateMoments(view, radiance, x, y);
+                }
             }
         }
     }
@@ -41,12 +41,15 @@ void UserInterface::update(
 
     ImGui::InputFloat("max error", &maxError);
 
+    _updateErrorStatistics();
+
     float numSamples = technique.numSamples();
     ImGui::InputFloat("samples ", &numSamples);
 
     _updateComputeAverage();
 
     ImGui::SliderFloat("brightness", &brightness, 0.0f, 50.0f);
+    ImGui::Checkbox("denoise", &denoise);
 
     size_t offset = min(100, int(maxErrors.size()));
 
@@ -119,6 +122,15 @@ void UserInterface::_updateComputeAverage() {
 }
 
 
+void UserInterface::_updateErrorStatistics() {
+    if(ImGui::CollapsingHeader("Error statistics")) {
+        ImGui::InputFloat("RMSE", &rmse);
+        ImGui::InputFloat("relMSE", &relMSE);
+        ImGui::InputFloat("avg abs error", &avgAbsError);
+        ImGui::InputFloat("avg rel error", &avgRelError);
+    }
+}
+
 void UserInterface::_updateStatistics(
     const Technique& technique,
     double elapsed)
@@ -134,7 +146,7 @@ void UserInterface::_updateStatistics(
         float localTimePerFrame = float(timePerFrame);
         ImGui::InputFloat("ms/frame", &localTimePerFrame);
 
-        float mainElapsed = float(glfwGetTime() - mainStart);
+        float mainElapsed = float(secondsSinceStart() - mainStart);
         ImGui::InputFloat("real time [s] ", &mainElapsed);
     }
 }
@@ -2,7 +2,6 @@
 #include <glm>
 #include <utility.hpp>
 #include <Technique.hpp>
-#include <GLFW/glfw3.h>
 
 namespace haste {
 
@@ -23,10 +22,12 @@ struct UserInterface {
 
     float avgRelError = 0.0f;
     float avgAbsError = 0.0f;
+    float rmse = 0.0f;
+    float relMSE = 0.0f;
     static const size_t pathSize = 255;
     char path[pathSize];
 
-    double mainStart = glfwGetTime();
+    double mainStart = secondsSinceStart();
     string scenePath;
     string defpath = homePath() + "/";
 
@@ -36,6 +37,7 @@ struct UserInterface {
     float& brightness;
 
     bool computeAverage = true;
+    bool denoise = false;
     vec3 averageValue = vec3(0.0f);
 
     UserInterface(
@@ -53,6 +55,8 @@ struct UserInterface {
 private:
     void _updateComputeAverage();
 
+    void _updateErrorStatistics();
+
     void _updateStatistics(
         const Technique& technique,
         double elapsed);
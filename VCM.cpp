@@ -9,12 +9,12 @@ VCM::VCM(
     size_t numGather,
     float maxRadius,
     size_t minSubpath,
-    float roulette)
+    float roulette,
+    float minSurvival)
     : _numPhotons(numPhotons)
     , _numGather(numGather)
     , _maxRadius(maxRadius)
-    , _minSubpath(minSubpath)
-    , _roulette(roulette)
+    , _roulette(minSubpath, roulette, minSurvival)
     , _eta(_numPhotons * pi<float>() * _maxRadius * _maxRadius)
 { }
 
@@ -33,7 +33,7 @@ string VCM::name() const {
     return "Vertex Connection and Merging";
 }
 
-vec3 VCM::_trace(RandomEngine& engine, const Ray& ray) {
+vec3 VCM::_trace(RandomEngine& engine, const Ray& ray, float scale) {
     LightVertex light[_maxSubpath];
     size_t lSize = 0;
 
@@ -51,7 +51,7 @@ vec3 VCM::_trace(RandomEngine& engine, const Ray& ray) {
     }
 
     if (!isect.isPresent()) {
-        return radiance;
+        return radiance + _scene->queryEnvironment(ray.direction);
     }
 
     eye[itr].surface = _scene->querySurface(isect);
@@ -67,7 +67,7 @@ vec3 VCM::_trace(RandomEngine& engine, const Ray& ray) {
     radiance += _gather(engine, eye[itr]);
     std::swap(itr, prv);
 
-    float roulette = eSize < _minSubpath ? 1.0f : _roulette;
+    float roulette = _roulette.expected(eye[prv].throughput, scale, eSize);
     float uniform = sampleUniform1(engine).value();
 
     while (uniform < roulette) {
@@ -102,7 +102,7 @@ vec3 VCM::_trace(RandomEngine& engine, const Ray& ray) {
         radiance += _gather(engine, eye[itr]);
         std::swap(itr, prv);
 
-        roulette = eSize < _minSubpath ? 1.0f : _roulette;
+        roulette = _roulette.expected(eye[prv].throughput, scale, eSize);
         uniform = sampleUniform1(engine).value();
     }
 
@@ -123,6 +123,10 @@ void VCM::_trace(RandomEngine& engine, size_t& size, LightVertex* path) {
 
     auto edge = Edge(light, isect);
 
+    if (light.distant()) {
+        edge.setDistant();
+    }
+
     path[itr].surface = _scene->querySurface(isect);
     path[itr]._omega = -light.omega();
     path[itr].throughput = light.radiance() * edge.bCosTheta / light.density();
@@ -134,10 +138,11 @@ void VCM::_trace(RandomEngine& engine, size_t& size, LightVertex* path) {
     ++itr;
 
     size_t lSize = 2;
-    float roulette = lSize < _minSubpath ? 1.0f : _roulette;
+    float roulette = _roulette.expected(lSize);
     float uniform = sampleUniform1(engine).value();
 
-    while (uniform < roulette) {
+    // Vertices are written at most at lSize - 1, keep them in the buffer.
+    while (lSize < _maxSubpath && uniform < roulette) {
         auto bsdf = _scene->sampleBSDF(engine, path[prv].surface, path[prv].omega());
 
         isect = _scene->intersectMesh(path[prv].position(), bsdf.omega());
@@ -170,7 +175,7 @@ void VCM::_trace(RandomEngine& engine, size_t& size, LightVertex* path) {
         }
 
         ++lSize;
-        roulette = lSize < _minSubpath ? 1.0f : _roulette;
+        roulette = _roulette.expected(lSize);
         uniform = sampleUniform1(engine).value();
     }
 
@@ -200,6 +205,10 @@ void VCM::_trace(RandomEngine& engine, size_t& size, LightPhoton* path) {
 
     auto edge = Edge(light, isect);
 
+    if (light.distant()) {
+        edge.setDistant();
+    }
+
     path[itr].surface = _scene->querySurface(isect);
     path[itr]._omega = -light.omega();
     path[itr].throughput = light.radiance() * edge.bCosTheta / light.density();
@@ -217,10 +226,11 @@ void VCM::_trace(RandomEngine& engine, size_t& size, LightPhoton* path) {
     ++itr;
 
     size_t lSize = 2;
-    float roulette = lSize < _minSubpath ? 1.0f : _roulette;
+    float roulette = _roulette.expected(lSize);
     float uniform = sampleUniform1(engine).value();
 
-    while (uniform < roulette) {
+    // Vertices are written at most at lSize - 1, keep them in the buffer.
+    while (lSize < _maxSubpath && uniform < roulette) {
         auto bsdf = _scene->sampleBSDF(engine, path[prv].surface, path[prv].omega());
 
         isect = _scene->intersectMesh(path[prv].position(), bsdf.omega());
@@ -260,7 +270,7 @@ void VCM::_trace(RandomEngine& engine, size_t& size, LightPhoton* path) {
         }
 
         ++lSize;
-        roulette = lSize < _minSubpath ? 1.0f : _roulette;
+        roulette = _roulette.expected(lSize);
         uniform = sampleUniform1(engine).value();
     }
 
@@ -338,6 +348,27 @@ vec3 VCM::_connect0(RandomEngine& engine, size_t eyeSize, const EyeVertex& eye)
         isect = _scene->intersect(isect.position(), bsdf.omega());
     }
 
+    if (!isect.isPresent()) {
+        auto lsdf = _scene->queryEnvironmentLSDF(bsdf.omega());
+        float bCosTheta = abs(dot(eye.gnormal(), bsdf.omega()));
+        float weightInv = 1.0f;
+
+        if (eye.specular * bsdf.specular() == 0.0f) {
+            // The environment is at infinity, only the cosine at the eye remains.
+            float c = 1.0f / bsdf.density();
+            float C = (eye.C * bsdf.densityRev() + eye.c + _eta) * bCosTheta * c;
+
+            weightInv += (C * lsdf.omegaDensity() + c) * lsdf.areaDensity();
+        }
+
+        radiance +=
+            lsdf.radiance() *
+            eye.throughput *
+            bsdf.throughput() *
+            bCosTheta /
+            (bsdf.density() * weightInv);
+    }
+
     return radiance;
 }
 
@@ -347,6 +378,10 @@ vec3 VCM::_connect1(RandomEngine& engine, size_t eyeSize, const EyeVertex& eye)
     auto bsdf = _scene->queryBSDFEx(eye.surface, -light.omega(), eye.omega());
     auto edge = Edge(light, eye, light.omega());
 
+    if (light.distant()) {
+        edge.setDistant();
+    }
+
     float Ap = bsdf.densityRev() * edge.bGeometry / light.areaDensity();
     float Bp = 0.0f;
     float Cp = (eye.C * bsdf.density() + eye.c) * edge.fGeometry * light.omegaDensity();
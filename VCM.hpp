@@ -11,7 +11,8 @@ public:
         size_t numGather = 100,
         float maxRadius = 0.33f,
         size_t minSubpath = 3,
-        float roulette = 0.5f);
+        float roulette = 0.5f,
+        float minSurvival = 0.1f);
 
     void preprocess(
         const shared<const Scene>& scene,
@@ -70,13 +71,12 @@ private:
     const size_t _numPhotons;
     const size_t _numGather;
     const float _maxRadius;
-    const size_t _minSubpath;
-    const float _roulette;
+    const Roulette _roulette;
     const float _eta;
 
     KDTree3D<LightPhoton> _vertices;
 
-    vec3 _trace(RandomEngine& engine, const Ray& ray) override;
+    vec3 _trace(RandomEngine& engine, const Ray& ray, float scale) override;
     void _trace(RandomEngine& engine, size_t& size, LightVertex* path);
     void _trace(RandomEngine& engine, size_t& size, LightPhoton* path);
     vec3 _connect(const EyeVertex& eye, const LightVertex& light);
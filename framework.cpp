@@ -2,19 +2,18 @@
 #include <iostream>
 #include <functional>
 #include <glm/glm.hpp>
-#include <glad/glad.h>
-#include <GLFW/glfw3.h>
-#include <imgui.h>
-#include <imgui_impl_glfw_gl3.h>
 #include <framework.hpp>
 
-#include <mutex>
-#include <condition_variable>
+#include <cstdint>
 #include <thread>
 #include <cstring>
 #include <chrono>
 #include <atomic>
 
+#ifndef HASTE_HEADLESS
+#include <imgui.h>
+#include <imgui_impl_glfw_gl3.h>
+
 GLFWwindow* create_window(int x, int y) {
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
@@ -313,99 +312,171 @@ int loop(GLFWwindow* window, const std::function<void(int, int, float&, void*)>&
     }
 }
 
+#endif
+
 Framework::~Framework() { }
 
 bool Framework::updateScene() {
     return false;
 }
 
+void Framework::present(glm::vec4* dst, const glm::vec4* src, size_t width, size_t height) {
+    const size_t size = width * height * sizeof(glm::vec4);
+    std::memcpy(dst, src, size);
+}
+
+bool Framework::interruptRequired() {
+    return false;
+}
+
+void Framework::interrupt() { }
+
+void Framework::resume() { }
+
 void Framework::postproc(glm::vec4* dst, const glm::vec4* src, size_t width, size_t height) {
     const size_t size = width * height * sizeof(glm::vec4);
     std::memcpy(dst, src, size);
 }
 
+#ifndef HASTE_HEADLESS
+// Triple buffer of accumulation snapshots. Each slot is owned either by the
+// render thread (back), the display (front) or neither (ready), ownership
+// changes by atomic exchanges only, so neither side ever waits.
+struct frame_exchange_t {
+    static const unsigned fresh_bit = 4;
+
+    struct snapshot_t {
+        std::vector<glm::vec4> data;
+        size_t width = 0;
+        size_t height = 0;
+    };
+
+    snapshot_t slots[3];
+    std::atomic<unsigned> ready;
+    unsigned back = 0;
+    unsigned front = 1;
+
+    frame_exchange_t() : ready(2) { }
+
+    snapshot_t& back_slot() { return slots[back]; }
+    const snapshot_t& front_slot() const { return slots[front]; }
+
+    void publish() {
+        back = ready.exchange(back | fresh_bit) & ~fresh_bit;
+    }
+
+    // A published snapshot the display hasn't taken yet.
+    bool pending() const {
+        return (ready.load() & fresh_bit) != 0;
+    }
+
+    bool acquire() {
+        if ((ready.load() & fresh_bit) == 0) {
+            return false;
+        }
+
+        front = ready.exchange(front) & ~fresh_bit;
+        return true;
+    }
+};
+
 int Framework::run(size_t width, size_t height) {
     return ::run(width, height, [=](GLFWwindow* window) {
         _window = window;
 
-        std::vector<glm::vec4> buffer;
-        std::atomic<size_t> bufferWidth, bufferHeight;
-        std::atomic<bool> trigger, done, quit;
-        std::mutex workerMutex;
-        std::condition_variable workerCondition;
-        std::condition_variable quitCondition;
+        frame_exchange_t exchange;
+        std::atomic<std::uint64_t> requestedSize;
+        std::atomic<bool> quit;
 
-        trigger = false;
-        done = true;
+        requestedSize = 0;
         quit = false;
 
+        // Renders passes back to back, the scene is reloaded between them.
         auto worker = std::thread([&]() {
+            std::vector<glm::vec4> buffer;
+            size_t bufferWidth = 0;
+            size_t bufferHeight = 0;
+
             while (!quit) {
-                while (!trigger) {
-                    std::unique_lock<std::mutex> lock(workerMutex);
-                    workerCondition.wait(lock);
-                }
+                // Before the size and the scene are checked, so a request
+                // made after this point interrupts the coming pass.
+                resume();
 
-                if (!quit) {
-                    trigger = false;
-                    render(bufferWidth, bufferHeight, buffer.data());
-                    done = true;
+                if (quit) {
+                    break;
                 }
-            }
 
-            quitCondition.notify_all();
-        });
+                const std::uint64_t size = requestedSize;
+                const size_t width = size_t(size >> 32);
+                const size_t height = size_t(size & 0xffffffffu);
 
-        loop(window, [&](int width, int height, float& scale, void* image) {
-            double start = glfwGetTime();
-            scale = _scale;
-
-            if (done) {
-                if (bufferWidth == width && bufferHeight == height) {
-                    postproc((glm::vec4*)image, buffer.data(), width, height);
-                }
-                else {
-                    buffer.resize(width * height);
-                    std::memset(buffer.data(), 0, buffer.size() * sizeof(glm::vec4));
+                if (bufferWidth != width || bufferHeight != height) {
+                    buffer.assign(width * height, glm::vec4(0.0f));
                     bufferWidth = width;
                     bufferHeight = height;
                 }
 
-                trigger = true;
                 if (updateScene()) {
                     std::memset(buffer.data(), 0, buffer.size() * sizeof(buffer[0]));
                 }
 
-                done = false;
-                workerCondition.notify_all();
+                if (buffer.empty()) {
+                    std::this_thread::yield();
+                    continue;
+                }
+
+                render(bufferWidth, bufferHeight, buffer.data());
+
+                // Passes can be faster than the display, presenting (and so
+                // denoising) is skipped until it takes the last snapshot.
+                if (exchange.pending()) {
+                    continue;
+                }
+
+                auto& snapshot = exchange.back_slot();
+                snapshot.data.resize(buffer.size());
+                present(snapshot.data.data(), buffer.data(), bufferWidth, bufferHeight);
+                snapshot.width = bufferWidth;
+                snapshot.height = bufferHeight;
+                exchange.publish();
+            }
+        });
+
+        loop(window, [&](int width, int height, float& scale, void* image) {
+            scale = _scale;
+
+            const std::uint64_t size = (std::uint64_t(width) << 32) | std::uint64_t(height);
+
+            if (requestedSize.exchange(size) != size || interruptRequired()) {
+                interrupt();
+            }
+
+            if (exchange.acquire()) {
+                const auto& snapshot = exchange.front_slot();
+
+                if (snapshot.width == width && snapshot.height == height) {
+                    postproc((glm::vec4*)image, snapshot.data.data(), width, height);
+                }
             }
 
             updateUI(width, height, (glm::vec4*)image);
 
+            // Limits the display rate only, rendering doesn't wait for it.
             std::this_thread::sleep_for(std::chrono::milliseconds(10));
         });
 
         quit = true;
-        trigger = true;
-        workerCondition.notify_all();
-
-        std::unique_lock<std::mutex> lock(workerMutex);
-        if (quitCondition.wait_for(lock, std::chrono::seconds(2)) != std::cv_status::timeout) {
-            worker.join();
-        }
+        interrupt();
+        worker.join();
     });
 
     _window = nullptr;
 
     return 0;
 }
+#endif
 
 int Framework::runBatch(size_t width, size_t height) {
-    if (!glfwInit()) {
-        std::cerr << "Cannot initialize glfw." << std::endl;
-        return -1;
-    }
-
     std::vector<glm::vec4> buffer;
     buffer.resize(width * height);
     std::memset(buffer.data(), 0, buffer.size() * sizeof(glm::vec4));
@@ -415,18 +486,18 @@ int Framework::runBatch(size_t width, size_t height) {
         render(width, height, buffer.data());
     }
 
-    glfwTerminate();
-
     return 0;
 }
 
 void Framework::quit() {
+#ifndef HASTE_HEADLESS
     if (_window) {
         glfwSetWindowShouldClose(_window, GLFW_TRUE);
+        return;
     }
-    else {
-        _quit = true;
-    }
+#endif
+
+    _quit = true;
 }
 
 bool Framework::batch() const {
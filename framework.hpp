@@ -2,6 +2,10 @@
 #include <vector>
 #include <functional>
 #include <glm/glm.hpp>
+
+// HASTE_HEADLESS builds (master-cli) have batch mode only and don't depend
+// on GLFW, glad or ImGui.
+#ifndef HASTE_HEADLESS
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
 
@@ -27,6 +31,9 @@ void draw_fullscreen_quad(
     float scale);
 
 int loop(GLFWwindow* window, const std::function<void(int, int, float&, void*)>& loop);
+#else
+struct GLFWwindow;
+#endif
 
 class Framework {
 public:
@@ -37,7 +44,20 @@ public:
     virtual void postproc(glm::vec4* dst, const glm::vec4* src, size_t width, size_t height);
     virtual bool updateScene();
 
+    // Fills the snapshot of a finished pass handed to the display, runs on
+    // the render thread. Copies the accumulation buffer by default.
+    virtual void present(glm::vec4* dst, const glm::vec4* src, size_t width, size_t height);
+
+    // The interactive loop polls interruptRequired() and calls interrupt()
+    // from the display thread to cut the pass in flight short, the render
+    // thread calls resume() before it starts the next one.
+    virtual bool interruptRequired();
+    virtual void interrupt();
+    virtual void resume();
+
+#ifndef HASTE_HEADLESS
     int run(size_t width, size_t height);
+#endif
     int runBatch(size_t width, size_t height);
     void quit();
     bool batch() const;
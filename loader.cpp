@@ -3,9 +3,16 @@
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <iostream>
+#include <map>
+#include <unordered_map>
 
 #include <utility.hpp>
 #include <loader.hpp>
+#include <SceneCache.hpp>
 
 namespace haste {
 
@@ -119,6 +126,46 @@ vec3 toVec3(const aiColor3D& v) {
     return vec3(v.r, v.g, v.b);
 }
 
+mat4 toMat4(const aiMatrix4x4& m) {
+    return transpose(mat4(
+        m.a1, m.a2, m.a3, m.a4,
+        m.b1, m.b2, m.b3, m.b4,
+        m.c1, m.c2, m.c3, m.c4,
+        m.d1, m.d2, m.d3, m.d4));
+}
+
+mat4 globalTransform(const aiNode* node) {
+    mat4 result = mat4(1.0f);
+
+    while (node != nullptr) {
+        result = toMat4(node->mTransformation) * result;
+        node = node->mParent;
+    }
+
+    return result;
+}
+
+mat4 globalTransform(const aiScene* scene, const aiString& name) {
+    const aiNode* node = scene->mRootNode->FindNode(name);
+    return node != nullptr ? globalTransform(node) : mat4(1.0f);
+}
+
+void collectMeshReferences(
+    const aiNode* node,
+    const mat4& parent,
+    vector<pair<unsigned, mat4>>& references)
+{
+    const mat4 transform = parent * toMat4(node->mTransformation);
+
+    for (unsigned i = 0; i < node->mNumMeshes; ++i) {
+        references.push_back(std::make_pair(node->mMeshes[i], transform));
+    }
+
+    for (unsigned i = 0; i < node->mNumChildren; ++i) {
+        collectMeshReferences(node->mChildren[i], transform, references);
+    }
+}
+
 string name(const aiMaterial* material) {
     aiString name;
     material->Get(AI_MATKEY_NAME, name);
@@ -309,6 +356,26 @@ template <class Stream> Stream& operator<<(
 
 
 
+// Every triangle of an emissive mesh becomes a light, the emissive color is
+// taken as the emitted radiance.
+void addMeshLights(
+    AreaLights& lights,
+    const string& name,
+    const vector<vec3>& vertices,
+    const vector<int>& indices,
+    const vec3& radiance)
+{
+    for (size_t i = 0; i < indices.size(); i += 3) {
+        const vec3& v0 = vertices[indices[i + 0]];
+        const vec3& v1 = vertices[indices[i + 1]];
+        const vec3& v2 = vertices[indices[i + 2]];
+
+        if (length(cross(v1 - v0, v2 - v0)) > 0.0f) {
+            lights.addLight(name, v0, v1, v2, radiance * pi<float>());
+        }
+    }
+}
+
 bool isEmissive(const aiScene* scene, size_t meshID) {
     size_t materialID = scene->mMeshes[meshID]->mMaterialIndex;
     auto material = scene->mMaterials[materialID];
@@ -321,12 +388,13 @@ AreaLights loadAreaLights(const aiScene* scene) {
     for (size_t i = 0; i < scene->mNumLights; ++i) {
         if (scene->mLights[i]->mType == aiLightSource_AREA) {
             auto light = scene->mLights[i];
+            mat4 transform = globalTransform(scene, light->mName);
 
             result.addLight(
                 toString(light->mName),
-                toVec3(light->mPosition),
-                normalize(toVec3(light->mDirection)),
-                normalize(toVec3(light->mUp)),
+                vec3(transform * vec4(toVec3(light->mPosition), 1.0f)),
+                normalize(mat3(transform) * toVec3(light->mDirection)),
+                normalize(mat3(transform) * toVec3(light->mUp)),
                 toVec3(light->mColorDiffuse),
                 toVec2(light->mSize));
         }
@@ -340,11 +408,13 @@ Cameras loadCameras(const aiScene* scene) {
 
     for (size_t i = 0; i < scene->mNumCameras; ++i) {
         auto camera = scene->mCameras[i];
+        mat4 transform = globalTransform(scene, camera->mName);
+
         cameras.addCameraFovX(
             toString(camera->mName),
-            toVec3(camera->mPosition),
-            normalize(toVec3(camera->mLookAt)),
-            normalize(toVec3(camera->mUp)),
+            vec3(transform * vec4(toVec3(camera->mPosition), 1.0f)),
+            normalize(mat3(transform) * toVec3(camera->mLookAt)),
+            normalize(mat3(transform) * toVec3(camera->mUp)),
             camera->mHorizontalFOV,
             camera->mClipPlaneNear,
             camera->mClipPlaneFar);
@@ -353,6 +423,24 @@ Cameras loadCameras(const aiScene* scene) {
     return cameras;
 }
 
+// Builds tangent frames for a mesh with vertices, normals and indices only.
+// Meshes have no texture coordinates and all BSDFs are isotropic, so any
+// tangent orthogonal to the normal will do. A fixed axis projected onto the
+// vertex normal depends on the normal only, vertices stay shared and the
+// frames are continuous wherever the normals are.
+void buildTangentFrames(Mesh& result) {
+    result.tangents.resize(result.vertices.size());
+    result.bitangents.resize(result.vertices.size());
+
+    parallelChunks(result.vertices.size(), [&](size_t j) {
+        vec3 normal = result.normals[j];
+        vec3 axis = abs(normal.x) < 0.9f ? vec3(1.0f, 0.0f, 0.0f) : vec3(0.0f, 1.0f, 0.0f);
+
+        result.tangents[j] = normalize(axis - dot(normal, axis) * normal);
+        result.bitangents[j] = normalize(cross(normal, result.tangents[j]));
+    });
+}
+
 Mesh aiMeshToMesh(const aiMesh* mesh) {
     runtime_assert(mesh != nullptr);
     runtime_assert(mesh->mNormals != nullptr);
@@ -362,32 +450,25 @@ Mesh aiMeshToMesh(const aiMesh* mesh) {
 
     if (mesh->mBitangents == nullptr ||
         mesh->mTangents == nullptr) {
+        result.normals.resize(mesh->mNumVertices);
+        result.vertices.resize(mesh->mNumVertices);
+
+        parallelChunks(mesh->mNumVertices, [&](size_t j) {
+            result.normals[j] = toVec3(mesh->mNormals[j]);
+            result.vertices[j] = toVec3(mesh->mVertices[j]);
+        });
+
         result.indices.resize(mesh->mNumFaces * 3);
-        result.bitangents.resize(mesh->mNumFaces * 3);
-        result.normals.resize(mesh->mNumFaces * 3);
-        result.tangents.resize(mesh->mNumFaces * 3);
-        result.vertices.resize(mesh->mNumFaces * 3);
 
-        for (size_t j = 0; j < mesh->mNumFaces; ++j) {
+        parallelChunks(mesh->mNumFaces, [&](size_t j) {
             runtime_assert(mesh->mFaces[j].mNumIndices == 3);
 
             for (size_t k = 0; k < 3; ++k) {
-                unsigned index = mesh->mFaces[j].mIndices[k];
-                result.indices[j * 3 + k] = j * 3 + k;
-                result.normals[j * 3 + k] = toVec3(mesh->mNormals[index]);
-                result.vertices[j * 3 + k] = toVec3(mesh->mVertices[index]);
+                result.indices[j * 3 + k] = mesh->mFaces[j].mIndices[k];
             }
+        });
 
-            vec3 edge = result.vertices[j * 3 + 1] - result.vertices[j * 3 + 0];
-
-            for (size_t k = 0; k < 3; ++k) {
-                vec3 normal = result.normals[j * 3 + k];
-                vec3 tangent = normalize(edge - dot(normal, edge) * normal);
-                vec3 bitangent = normalize(cross(normal, tangent));
-                result.bitangents[j * 3 + k] = bitangent;
-                result.tangents[j * 3 + k] = tangent;
-            }
-        }
+        buildTangentFrames(result);
     }
     else {
         result.bitangents.resize(mesh->mNumVertices);
@@ -395,22 +476,22 @@ Mesh aiMeshToMesh(const aiMesh* mesh) {
         result.tangents.resize(mesh->mNumVertices);
         result.vertices.resize(mesh->mNumVertices);
 
-        for (size_t j = 0; j < mesh->mNumVertices; ++j) {
+        parallelChunks(mesh->mNumVertices, [&](size_t j) {
             result.bitangents[j] = toVec3(mesh->mBitangents[j]);
             result.normals[j] = toVec3(mesh->mNormals[j]);
             result.tangents[j] = toVec3(mesh->mTangents[j]);
             result.vertices[j] = toVec3(mesh->mVertices[j]);
-        }
+        });
 
         result.indices.resize(mesh->mNumFaces * 3);
 
-        for (size_t j = 0; j < mesh->mNumFaces; ++j) {
+        parallelChunks(mesh->mNumFaces, [&](size_t j) {
             runtime_assert(mesh->mFaces[j].mNumIndices == 3);
 
             for (size_t k = 0; k < 3; ++k) {
                 result.indices[j * 3 + k] = mesh->mFaces[j].mIndices[k];
             }
-        }
+        });
     }
 
     result.name = mesh->mName.C_Str();
@@ -419,14 +500,27 @@ Mesh aiMeshToMesh(const aiMesh* mesh) {
     return result;
 }
 
-shared<Scene> loadScene(string path) {
+Mesh transformMesh(Mesh&& mesh, const mat4& transform) {
+    const mat3 linear = mat3(transform);
+    const mat3 normalTransform = transpose(inverse(linear));
+
+    parallelChunks(mesh.vertices.size(), [&](size_t i) {
+        mesh.vertices[i] = vec3(transform * vec4(mesh.vertices[i], 1.0f));
+        mesh.normals[i] = normalize(normalTransform * mesh.normals[i]);
+        mesh.tangents[i] = normalize(linear * mesh.tangents[i]);
+        mesh.bitangents[i] = normalize(linear * mesh.bitangents[i]);
+    });
+
+    return move(mesh);
+}
+
+SceneDesc importScene(const string& path) {
     Assimp::Importer importer;
 
     auto flags =
         aiProcess_Triangulate |
         aiProcess_GenNormals |
-        aiProcess_JoinIdenticalVertices |
-        aiProcess_PreTransformVertices;
+        aiProcess_JoinIdenticalVertices;
 
     const aiScene* scene = importer.ReadFile(path, flags);
 
@@ -436,49 +530,741 @@ shared<Scene> loadScene(string path) {
         throw std::runtime_error("Cannot load \"" + path + "\" scene.");
     }
 
-    vector<Mesh> meshes;
-    vector<size_t> emissive;
+    SceneDesc result;
+
+    vector<pair<unsigned, mat4>> references;
+    collectMeshReferences(scene->mRootNode, mat4(1.0f), references);
+
+    vector<size_t> numReferences(scene->mNumMeshes, 0);
+
+    for (size_t i = 0; i < references.size(); ++i) {
+        ++numReferences[references[i].first];
+    }
+
+    vector<Mesh>& meshes = result.meshes;
+
+    // Meshes referenced once are pre-transformed to world space, the ones
+    // referenced many times become instanced prototypes (Scene expects them
+    // after all world space meshes). The order is decided first, the
+    // conversion itself runs in parallel.
+    vector<pair<unsigned, const mat4*>> conversions;
+
+    for (size_t i = 0; i < references.size(); ++i) {
+        unsigned meshID = references[i].first;
 
-    for (size_t i = 0; i < scene->mNumMeshes; ++i) {
-        if (isEmissive(scene, i)) {
-            emissive.push_back(i);
+        if (numReferences[meshID] == 1 && !isEmissive(scene, meshID)) {
+            conversions.push_back(std::make_pair(meshID, &references[i].second));
         }
-        else {
-            meshes.push_back(aiMeshToMesh(scene->mMeshes[i]));
+    }
+
+    vector<size_t> prototypes(scene->mNumMeshes, SIZE_MAX);
+    vector<Instance>& instances = result.instances;
+
+    for (size_t i = 0; i < references.size(); ++i) {
+        unsigned meshID = references[i].first;
+
+        if (numReferences[meshID] > 1 && !isEmissive(scene, meshID)) {
+            if (prototypes[meshID] == SIZE_MAX) {
+                prototypes[meshID] = conversions.size();
+                conversions.push_back(std::make_pair(meshID, (const mat4*)nullptr));
+            }
+
+            Instance instance;
+            instance.meshId = prototypes[meshID];
+            instance.transform = references[i].second;
+            instances.push_back(instance);
         }
     }
 
-    AreaLights lights = loadAreaLights(scene);
+    meshes.resize(conversions.size());
 
-    Materials materials;
+    tbb::parallel_for(size_t(0), conversions.size(), [&](size_t i) {
+        const aiMesh* mesh = scene->mMeshes[conversions[i].first];
+        const mat4* transform = conversions[i].second;
+
+        if (transform != nullptr) {
+            meshes[i] = transformMesh(aiMeshToMesh(mesh), *transform);
+        }
+        else {
+            meshes[i] = aiMeshToMesh(mesh);
+            meshes[i].instanced = true;
+        }
+    });
+
+    result.lights = loadAreaLights(scene);
+    result.cameras = loadCameras(scene);
+
+    for (size_t i = 0; i < references.size(); ++i) {
+        unsigned meshID = references[i].first;
+
+        if (isEmissive(scene, meshID)) {
+            const aiMesh* mesh = scene->mMeshes[meshID];
+            const mat4& transform = references[i].second;
+
+            vector<vec3> vertices(mesh->mNumVertices);
+            vector<int> indices;
+
+            for (size_t j = 0; j < mesh->mNumVertices; ++j) {
+                vertices[j] = vec3(transform * vec4(toVec3(mesh->mVertices[j]), 1.0f));
+            }
+
+            for (size_t j = 0; j < mesh->mNumFaces; ++j) {
+                runtime_assert(mesh->mFaces[j].mNumIndices == 3);
+
+                for (size_t k = 0; k < 3; ++k) {
+                    indices.push_back(mesh->mFaces[j].mIndices[k]);
+                }
+            }
+
+            auto material = scene->mMaterials[mesh->mMaterialIndex];
+
+            addMeshLights(
+                result.lights,
+                toString(mesh->mName),
+                vertices,
+                indices,
+                emissive(material));
+        }
+    }
 
     for (size_t i = 0; i < scene->mNumMaterials; ++i) {
         const aiMaterial* material = scene->mMaterials[i];
 
-        materials.names.push_back(name(scene->mMaterials[i]));
-        materials.diffuses.push_back(diffuse(scene->mMaterials[i]));
-        materials.speculars.push_back(specular(scene->mMaterials[i]));
+        MaterialDesc desc;
+        desc.name = name(material);
+        desc.diffuse = diffuse(material);
+        desc.specular = specular(material);
+        desc.bsdf = MaterialBSDFDiffuse;
+        desc.ior = 1.0f;
 
         if (property<bool>(material, "$mat.blend.transparency.use")) {
-            float ior = property<float>(material, "$mat.blend.transparency.ior");
-            auto bsdf = unique<BSDF>(new PerfectTransmissionBSDF(ior, 1.0f));
-            materials.bsdfs.push_back(std::move(bsdf));
+            desc.bsdf = MaterialBSDFTransmission;
+            desc.ior = property<float>(material, "$mat.blend.transparency.ior");
         }
         else if (property<bool>(material, "$mat.blend.mirror.use")) {
-            materials.bsdfs.push_back(unique<BSDF>(new PerfectReflectionBSDF()));
+            desc.bsdf = MaterialBSDFReflection;
+        }
+
+        result.materials.push_back(desc);
+    }
+
+    return result;
+}
+
+//
+// Native OBJ/MTL import. The file is memory mapped and split into chunks at
+// line boundaries. The chunks are first scanned in parallel to count the
+// vertices and normals (so the absolute index of every element is known up
+// front) and then parsed in parallel. Meshes are assembled in parallel too,
+// one per run of faces sharing the group and the material.
+//
+
+struct OBJCorner {
+    int vertex;
+    int normal; // -1 if missing
+};
+
+struct OBJFace {
+    size_t firstCorner;
+    size_t numCorners;
+};
+
+struct OBJChange {
+    size_t face; // first face the change applies to
+    bool material; // group otherwise
+    string value;
+};
+
+struct OBJChunk {
+    const char* begin;
+    const char* end;
+    size_t firstVertex = 0;
+    size_t firstNormal = 0;
+    size_t numVertices = 0;
+    size_t numNormals = 0;
+    vector<OBJCorner> corners;
+    vector<OBJFace> faces;
+    vector<OBJChange> changes;
+    vector<string> mtllibs;
+};
+
+struct OBJSegment {
+    const OBJChunk* chunk;
+    size_t firstFace;
+    size_t endFace;
+};
+
+struct OBJRun {
+    string name;
+    string material;
+    vector<OBJSegment> segments;
+};
+
+inline bool isSpace(char c) {
+    return c == ' ' || c == '\t';
+}
+
+inline bool isDigit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+inline const char* skipSpace(const char* s, const char* e) {
+    while (s < e && isSpace(*s)) {
+        ++s;
+    }
+
+    return s;
+}
+
+inline const char* skipLine(const char* s, const char* e) {
+    while (s < e && *s != '\n') {
+        ++s;
+    }
+
+    return s < e ? s + 1 : e;
+}
+
+inline bool atLineEnd(const char* s, const char* e) {
+    return s == e || *s == '\n' || *s == '\r' || *s == '#';
+}
+
+const char* parseFloat(const char* s, const char* e, float& result) {
+    static const double powers[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+
+    s = skipSpace(s, e);
+
+    bool negative = false;
+
+    if (s < e && (*s == '-' || *s == '+')) {
+        negative = *s == '-';
+        ++s;
+    }
+
+    std::uint64_t digits = 0;
+    int numDigits = 0;
+    int exponent = 0;
+
+    for (; s < e && isDigit(*s); ++s) {
+        if (numDigits < 19) {
+            digits = digits * 10 + (*s - '0');
+            numDigits += digits != 0;
         }
         else {
-            materials.bsdfs.push_back(unique<BSDF>(new DiffuseBSDF(materials.diffuses.back())));
+            ++exponent;
+        }
+    }
+
+    if (s < e && *s == '.') {
+        for (++s; s < e && isDigit(*s); ++s) {
+            if (numDigits < 19) {
+                digits = digits * 10 + (*s - '0');
+                numDigits += digits != 0;
+                --exponent;
+            }
         }
     }
 
-    shared<Scene> result = make_shared<Scene>(
-        loadCameras(scene),
-        move(materials),
-        move(meshes),
-        move(lights));
+    if (s < e && (*s == 'e' || *s == 'E')) {
+        ++s;
+        bool negativeExponent = false;
+
+        if (s < e && (*s == '-' || *s == '+')) {
+            negativeExponent = *s == '-';
+            ++s;
+        }
+
+        int value = 0;
+
+        for (; s < e && isDigit(*s); ++s) {
+            value = std::min(value * 10 + (*s - '0'), 9999);
+        }
+
+        exponent += negativeExponent ? -value : value;
+    }
+
+    double value = double(digits);
+
+    if (exponent < 0) {
+        value = -exponent <= 22 ? value / powers[-exponent] : value * std::pow(10.0, exponent);
+    }
+    else if (exponent > 0) {
+        value = exponent <= 22 ? value * powers[exponent] : value * std::pow(10.0, exponent);
+    }
+
+    result = float(negative ? -value : value);
+    return s;
+}
+
+const char* parseVec3(const char* s, const char* e, vec3& result) {
+    s = parseFloat(s, e, result.x);
+    s = parseFloat(s, e, result.y);
+    return parseFloat(s, e, result.z);
+}
+
+const char* parseInt(const char* s, const char* e, int& result) {
+    bool negative = false;
+
+    if (s < e && (*s == '-' || *s == '+')) {
+        negative = *s == '-';
+        ++s;
+    }
+
+    result = 0;
+
+    for (; s < e && isDigit(*s); ++s) {
+        result = result * 10 + (*s - '0');
+    }
+
+    result = negative ? -result : result;
+    return s;
+}
+
+// Returns the keyword at the beginning of the line, s is moved past it.
+string parseKeyword(const char*& s, const char* e) {
+    s = skipSpace(s, e);
+    const char* begin = s;
+
+    while (s < e && !isSpace(*s) && *s != '\n' && *s != '\r') {
+        ++s;
+    }
+
+    return string(begin, s);
+}
+
+string parseRest(const char* s, const char* e) {
+    s = skipSpace(s, e);
+    const char* end = s;
+
+    while (end < e && *end != '\n' && *end != '\r' && *end != '#') {
+        ++end;
+    }
+
+    while (end > s && isSpace(end[-1])) {
+        --end;
+    }
+
+    return string(s, end);
+}
+
+// Lines are tokenized exactly as in parseOBJChunk, the counts size the
+// arrays it writes to.
+void countOBJChunk(OBJChunk& chunk) {
+    const char* e = chunk.end;
+
+    for (const char* s = chunk.begin; s < e; s = skipLine(s, e)) {
+        string keyword = parseKeyword(s, e);
+
+        if (keyword == "v") {
+            ++chunk.numVertices;
+        }
+        else if (keyword == "vn") {
+            ++chunk.numNormals;
+        }
+    }
+}
+
+int resolveOBJIndex(int index, size_t count) {
+    return index > 0 ? index - 1 : int(count) + index;
+}
+
+void parseOBJChunk(OBJChunk& chunk, vector<vec3>& vertices, vector<vec3>& normals) {
+    const char* e = chunk.end;
+    size_t vertex = chunk.firstVertex;
+    size_t normal = chunk.firstNormal;
+
+    for (const char* s = chunk.begin; s < e; s = skipLine(s, e)) {
+        const char* line = s;
+        string keyword = parseKeyword(s, e);
+
+        if (keyword == "v") {
+            parseVec3(s, e, vertices[vertex++]);
+        }
+        else if (keyword == "vn") {
+            parseVec3(s, e, normals[normal++]);
+        }
+        else if (keyword == "f") {
+            OBJFace face;
+            face.firstCorner = chunk.corners.size();
+
+            for (s = skipSpace(s, e); !atLineEnd(s, e); s = skipSpace(s, e)) {
+                int v = 0, vt = 0, vn = 0;
+                s = parseInt(s, e, v);
+
+                if (s < e && *s == '/') {
+                    s = parseInt(s + 1, e, vt);
+
+                    if (s < e && *s == '/') {
+                        s = parseInt(s + 1, e, vn);
+                    }
+                }
+
+                if (v == 0) {
+                    throw std::runtime_error(
+                        "Invalid face \"" + parseRest(line, e) + "\" in OBJ file.");
+                }
+
+                OBJCorner corner;
+                corner.vertex = resolveOBJIndex(v, vertex);
+                corner.normal = vn != 0 ? resolveOBJIndex(vn, normal) : -1;
+                chunk.corners.push_back(corner);
+            }
+
+            face.numCorners = chunk.corners.size() - face.firstCorner;
+
+            if (face.numCorners >= 3) {
+                chunk.faces.push_back(face);
+            }
+            else {
+                chunk.corners.resize(face.firstCorner);
+            }
+        }
+        else if (keyword == "g" || keyword == "o" || keyword == "usemtl") {
+            OBJChange change;
+            change.face = chunk.faces.size();
+            change.material = keyword == "usemtl";
+            change.value = parseRest(s, e);
+            chunk.changes.push_back(change);
+        }
+        else if (keyword == "mtllib") {
+            chunk.mtllibs.push_back(parseRest(s, e));
+        }
+    }
+}
+
+void loadMTL(
+    const string& path,
+    vector<MaterialDesc>& materials,
+    vector<vec3>& emissives)
+{
+    MappedFile file(path);
+
+    if (file.data() == nullptr) {
+        std::cerr << "Cannot load \"" << path << "\" material library." << std::endl;
+        return;
+    }
+
+    const char* e = file.data() + file.size();
+
+    for (const char* s = file.data(); s < e; s = skipLine(s, e)) {
+        string keyword = parseKeyword(s, e);
+
+        if (keyword == "newmtl") {
+            MaterialDesc material;
+            material.name = parseRest(s, e);
+            material.diffuse = vec3(0.0f);
+            material.specular = vec3(0.0f);
+            material.bsdf = MaterialBSDFDiffuse;
+            material.ior = 1.0f;
+            materials.push_back(material);
+            emissives.push_back(vec3(0.0f));
+        }
+        else if (materials.empty()) {
+            continue;
+        }
+        else if (keyword == "Kd") {
+            parseVec3(s, e, materials.back().diffuse);
+        }
+        else if (keyword == "Ks") {
+            parseVec3(s, e, materials.back().specular);
+        }
+        else if (keyword == "Ke") {
+            parseVec3(s, e, emissives.back());
+        }
+        else if (keyword == "Ni") {
+            parseFloat(s, e, materials.back().ior);
+        }
+    }
+}
+
+Mesh makeOBJMesh(
+    const OBJRun& run,
+    unsigned materialID,
+    const vector<vec3>& vertices,
+    const vector<vec3>& normals)
+{
+    Mesh mesh;
+    mesh.name = run.name;
+    mesh.materialID = materialID;
+
+    std::unordered_map<std::uint64_t, int> shared;
+    vector<int> polygon;
+
+    auto check = [](int index, size_t size) {
+        if (index < 0 || size_t(index) >= size) {
+            throw std::runtime_error("Index out of range in OBJ file.");
+        }
+    };
+
+    for (auto&& segment : run.segments) {
+        for (size_t i = segment.firstFace; i < segment.endFace; ++i) {
+            const OBJFace& face = segment.chunk->faces[i];
+            const OBJCorner* corners = segment.chunk->corners.data() + face.firstCorner;
+
+            bool smooth = true;
+
+            for (size_t k = 0; k < face.numCorners; ++k) {
+                check(corners[k].vertex, vertices.size());
+                smooth = smooth && corners[k].normal != -1;
+            }
+
+            polygon.clear();
+
+            if (smooth) {
+                for (size_t k = 0; k < face.numCorners; ++k) {
+                    check(corners[k].normal, normals.size());
+
+                    std::uint64_t key =
+                        std::uint64_t(corners[k].vertex) << 32 |
+                        std::uint32_t(corners[k].normal);
+
+                    auto inserted = shared.insert(std::make_pair(key, int(mesh.vertices.size())));
+
+                    if (inserted.second) {
+                        mesh.vertices.push_back(vertices[corners[k].vertex]);
+                        mesh.normals.push_back(normalize(normals[corners[k].normal]));
+                    }
+
+                    polygon.push_back(inserted.first->second);
+                }
+            }
+            else {
+                // Flat shaded polygon (Newell's normal), its vertices aren't shared.
+                vec3 normal = vec3(0.0f);
+
+                for (size_t k = 0; k < face.numCorners; ++k) {
+                    vec3 a = vertices[corners[k].vertex];
+                    vec3 b = vertices[corners[(k + 1) % face.numCorners].vertex];
+                    normal += cross(a, b);
+                }
+
+                normal = dot(normal, normal) > 0.0f ? normalize(normal) : vec3(0.0f, 0.0f, 1.0f);
+
+                for (size_t k = 0; k < face.numCorners; ++k) {
+                    polygon.push_back(int(mesh.vertices.size()));
+                    mesh.vertices.push_back(vertices[corners[k].vertex]);
+                    mesh.normals.push_back(normal);
+                }
+            }
+
+            for (size_t k = 2; k < polygon.size(); ++k) {
+                mesh.indices.push_back(polygon[0]);
+                mesh.indices.push_back(polygon[k - 1]);
+                mesh.indices.push_back(polygon[k]);
+            }
+        }
+    }
+
+    buildTangentFrames(mesh);
+
+    return mesh;
+}
+
+SceneDesc importOBJ(const string& path) {
+    MappedFile file(path);
+
+    if (file.data() == nullptr) {
+        throw std::runtime_error("Cannot load \"" + path + "\" scene.");
+    }
+
+    static const size_t chunkSize = 4 * 1024 * 1024;
+
+    vector<OBJChunk> chunks;
+    const char* e = file.data() + file.size();
+
+    for (const char* s = file.data(); s < e;) {
+        OBJChunk chunk;
+        chunk.begin = s;
+        chunk.end = size_t(e - s) > chunkSize ? skipLine(s + chunkSize, e) : e;
+        chunks.push_back(chunk);
+        s = chunk.end;
+    }
+
+    tbb::parallel_for(size_t(0), chunks.size(), [&](size_t i) {
+        countOBJChunk(chunks[i]);
+    });
+
+    size_t numVertices = 0;
+    size_t numNormals = 0;
+
+    for (auto& chunk : chunks) {
+        chunk.firstVertex = numVertices;
+        chunk.firstNormal = numNormals;
+        numVertices += chunk.numVertices;
+        numNormals += chunk.numNormals;
+    }
+
+    vector<vec3> vertices(numVertices);
+    vector<vec3> normals(numNormals);
+
+    tbb::parallel_for(size_t(0), chunks.size(), [&](size_t i) {
+        parseOBJChunk(chunks[i], vertices, normals);
+    });
+
+    SceneDesc result;
+    vector<vec3> emissives;
+    string directory = path.find_last_of("/\\") != string::npos ? dirname(path) + "/" : "";
+
+    for (auto&& chunk : chunks) {
+        for (auto&& mtllib : chunk.mtllibs) {
+            loadMTL(directory + mtllib, result.materials, emissives);
+            result.dependencies.push_back(directory + mtllib);
+        }
+    }
+
+    // Splits the faces into runs of the same group and material.
+    vector<OBJRun> runs(1);
+
+    for (auto&& chunk : chunks) {
+        size_t firstFace = 0;
+
+        for (size_t i = 0; i <= chunk.changes.size(); ++i) {
+            size_t endFace = i < chunk.changes.size() ? chunk.changes[i].face : chunk.faces.size();
+
+            if (firstFace < endFace) {
+                OBJSegment segment;
+                segment.chunk = &chunk;
+                segment.firstFace = firstFace;
+                segment.endFace = endFace;
+                runs.back().segments.push_back(segment);
+            }
+
+            if (i < chunk.changes.size()) {
+                OBJRun run = runs.back();
+                run.segments.clear();
+
+                if (chunk.changes[i].material) {
+                    run.material = chunk.changes[i].value;
+                }
+                else {
+                    run.name = chunk.changes[i].value;
+                }
+
+                if (runs.back().segments.empty()) {
+                    runs.back() = run;
+                }
+                else {
+                    runs.push_back(run);
+                }
+            }
+
+            firstFace = endFace;
+        }
+    }
+
+    std::map<string, unsigned> materialIDs;
+
+    for (size_t i = 0; i < result.materials.size(); ++i) {
+        materialIDs.insert(std::make_pair(result.materials[i].name, unsigned(i)));
+    }
+
+    // Emissive runs become lights, not meshes.
+    vector<const OBJRun*> visible;
+    vector<unsigned> visibleMaterials;
+    vector<const OBJRun*> emitters;
+    vector<unsigned> emitterMaterials;
+
+    for (auto&& run : runs) {
+        auto itr = materialIDs.find(run.material);
+
+        if (itr == materialIDs.end()) {
+            MaterialDesc material;
+            material.name = run.material.empty() ? "DefaultMaterial" : run.material;
+            material.diffuse = vec3(0.6f);
+            material.specular = vec3(0.0f);
+            material.bsdf = MaterialBSDFDiffuse;
+            material.ior = 1.0f;
+
+            itr = materialIDs.insert(std::make_pair(run.material, unsigned(result.materials.size()))).first;
+            result.materials.push_back(material);
+            emissives.push_back(vec3(0.0f));
+        }
+
+        if (run.segments.empty()) {
+            continue;
+        }
+        else if (emissives[itr->second] == vec3(0.0f)) {
+            visible.push_back(&run);
+            visibleMaterials.push_back(itr->second);
+        }
+        else {
+            emitters.push_back(&run);
+            emitterMaterials.push_back(itr->second);
+        }
+    }
+
+    result.meshes.resize(visible.size());
+
+    tbb::parallel_for(size_t(0), visible.size(), [&](size_t i) {
+        result.meshes[i] = makeOBJMesh(*visible[i], visibleMaterials[i], vertices, normals);
+    });
+
+    for (size_t i = 0; i < emitters.size(); ++i) {
+        Mesh mesh = makeOBJMesh(*emitters[i], emitterMaterials[i], vertices, normals);
+
+        addMeshLights(
+            result.lights,
+            mesh.name,
+            mesh.vertices,
+            mesh.indices,
+            emissives[emitterMaterials[i]]);
+    }
 
     return result;
 }
 
+bool isOBJ(const string& path) {
+    string extension = splitext(path).second;
+    std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+    return extension == ".obj";
+}
+
+Materials makeMaterials(const vector<MaterialDesc>& descs) {
+    Materials materials;
+
+    for (auto&& desc : descs) {
+        materials.names.push_back(desc.name);
+        materials.diffuses.push_back(desc.diffuse);
+        materials.speculars.push_back(desc.specular);
+        materials.iors.push_back(desc.ior);
+
+        switch (desc.bsdf) {
+            case MaterialBSDFTransmission:
+                materials.bsdfs.push_back(unique<BSDF>(
+                    new PerfectTransmissionBSDF(desc.ior, 1.0f)));
+                break;
+            case MaterialBSDFReflection:
+                materials.bsdfs.push_back(unique<BSDF>(new PerfectReflectionBSDF()));
+                break;
+            default:
+                materials.bsdfs.push_back(unique<BSDF>(new DiffuseBSDF(desc.diffuse)));
+                break;
+        }
+    }
+
+    return materials;
+}
+
+shared<Scene> loadScene(string path, bool compressMeshes, bool sceneCache) {
+    SceneDesc desc;
+
+    if (!sceneCache || !readSceneCache(desc, path)) {
+        desc = isOBJ(path) ? importOBJ(path) : importScene(path);
+
+        if (sceneCache) {
+            writeSceneCache(path, desc);
+        }
+    }
+
+    return make_shared<Scene>(
+        move(desc.cameras),
+        makeMaterials(desc.materials),
+        move(desc.meshes),
+        move(desc.instances),
+        move(desc.lights),
+        compressMeshes);
+}
+
 }
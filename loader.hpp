@@ -1,8 +1,14 @@
 #pragma once
-#include <Scene.hpp>
+#include <SceneCache.hpp>
 
 namespace haste {
 
-shared<Scene> loadScene(string path);
+shared<Scene> loadScene(
+    string path,
+    bool compressMeshes = false,
+    bool sceneCache = false);
+
+// Native OBJ/MTL import, used by loadScene for .obj files.
+SceneDesc importOBJ(const string& path);
 
 }
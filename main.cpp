@@ -21,12 +21,17 @@ int main(int argc, char **argv) {
 
     Application application(options);
 
+    if (options.tileSize != 0) {
+        return application.runTiled(options.width, options.height);
+    }
+
+#ifndef HASTE_HEADLESS
     if (!options.batch) {
         return application.run(options.width, options.height);
     }
-    else {
-        return application.runBatch(options.width, options.height);
-    }
+#endif
+
+    return application.runBatch(options.width, options.height);
 
     return 0;
 }
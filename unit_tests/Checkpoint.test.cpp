@@ -0,0 +1,126 @@
+#include <gtest>
+#include <Checkpoint.hpp>
+#include <cstdio>
+#include <unistd.h>
+
+using namespace glm;
+using namespace haste;
+
+static const string path = "Checkpoint.test.bin";
+
+struct CheckpointImage {
+    CheckpointImage(size_t width, size_t height, bool features, float value)
+        : data(width * height, vec4(value))
+        , albedo(width * height, vec4(value * 2.0f))
+        , normal(width * height, vec4(value * 3.0f))
+        , moments(width * height, value * 4.0f)
+        , view(data.data(), width, height)
+    {
+        if (features) {
+            view._albedo = albedo.data();
+            view._normal = normal.data();
+            view._moments = moments.data();
+        }
+    }
+
+    vector<vec4> data;
+    vector<vec4> albedo;
+    vector<vec4> normal;
+    vector<float> moments;
+    ImageView view;
+};
+
+static Checkpoint makeCheckpoint() {
+    Checkpoint checkpoint;
+    checkpoint.technique = "PT";
+    checkpoint.numSamples = 12;
+    checkpoint.elapsed = 34.5;
+    checkpoint.engine = "48271 16807";
+    checkpoint.state = { 'a', 'b', 'c' };
+    return checkpoint;
+}
+
+TEST(CheckpointTest, round_trip) {
+    CheckpointImage written(5, 3, true, 0.0f);
+
+    for (size_t i = 0; i < 15; ++i) {
+        written.data[i] = vec4(float(i), 1.0f, 2.0f, 12.0f);
+        written.albedo[i] = vec4(0.5f, float(i), 0.5f, 12.0f);
+        written.normal[i] = vec4(0.0f, 0.0f, 1.0f, float(i));
+        written.moments[i] = float(i * i);
+    }
+
+    ASSERT_TRUE(writeCheckpoint(path, makeCheckpoint(), written.view));
+
+    CheckpointImage read(5, 3, true, -1.0f);
+    Checkpoint checkpoint;
+    ASSERT_TRUE(readCheckpoint(checkpoint, read.view, path));
+
+    EXPECT_EQ("PT", checkpoint.technique);
+    EXPECT_EQ(12, checkpoint.numSamples);
+    EXPECT_EQ(34.5, checkpoint.elapsed);
+    EXPECT_EQ("48271 16807", checkpoint.engine);
+    EXPECT_EQ(makeCheckpoint().state, checkpoint.state);
+
+    EXPECT_EQ(written.data, read.data);
+    EXPECT_EQ(written.albedo, read.albedo);
+    EXPECT_EQ(written.normal, read.normal);
+    EXPECT_EQ(written.moments, read.moments);
+
+    std::remove(path.c_str());
+}
+
+TEST(CheckpointTest, rejects_other_size) {
+    CheckpointImage written(5, 3, false, 1.0f);
+    ASSERT_TRUE(writeCheckpoint(path, makeCheckpoint(), written.view));
+
+    CheckpointImage wider(6, 3, false, -1.0f);
+    CheckpointImage higher(5, 4, false, -1.0f);
+    Checkpoint checkpoint;
+
+    EXPECT_FALSE(readCheckpoint(checkpoint, wider.view, path));
+    EXPECT_FALSE(readCheckpoint(checkpoint, higher.view, path));
+
+    // The view and the checkpoint are left intact.
+    EXPECT_EQ(vector<vec4>(18, vec4(-1.0f)), wider.data);
+    EXPECT_EQ("", checkpoint.technique);
+
+    std::remove(path.c_str());
+}
+
+TEST(CheckpointTest, rejects_other_features) {
+    CheckpointImage plain(5, 3, false, 1.0f);
+    CheckpointImage features(5, 3, true, 1.0f);
+    Checkpoint checkpoint;
+
+    ASSERT_TRUE(writeCheckpoint(path, makeCheckpoint(), plain.view));
+    CheckpointImage withFeatures(5, 3, true, -1.0f);
+    EXPECT_FALSE(readCheckpoint(checkpoint, withFeatures.view, path));
+    EXPECT_EQ(vector<float>(15, -4.0f), withFeatures.moments);
+
+    ASSERT_TRUE(writeCheckpoint(path, makeCheckpoint(), features.view));
+    CheckpointImage withoutFeatures(5, 3, false, -1.0f);
+    EXPECT_FALSE(readCheckpoint(checkpoint, withoutFeatures.view, path));
+    EXPECT_EQ(vector<vec4>(15, vec4(-1.0f)), withoutFeatures.data);
+
+    std::remove(path.c_str());
+}
+
+TEST(CheckpointTest, rejects_truncated) {
+    CheckpointImage written(5, 3, true, 1.0f);
+    ASSERT_TRUE(writeCheckpoint(path, makeCheckpoint(), written.view));
+    ASSERT_EQ(0, truncate(path.c_str(), 100));
+
+    CheckpointImage read(5, 3, true, -1.0f);
+    Checkpoint checkpoint;
+    EXPECT_FALSE(readCheckpoint(checkpoint, read.view, path));
+    EXPECT_EQ(vector<vec4>(15, vec4(-1.0f)), read.data);
+
+    std::remove(path.c_str());
+}
+
+TEST(CheckpointTest, rejects_missing) {
+    CheckpointImage read(5, 3, false, -1.0f);
+    Checkpoint checkpoint;
+    EXPECT_FALSE(readCheckpoint(checkpoint, read.view, "Checkpoint.test.missing"));
+}
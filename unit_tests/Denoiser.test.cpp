@@ -0,0 +1,105 @@
+#include <gtest>
+#include <Denoiser.hpp>
+#include <Sample.hpp>
+
+using namespace glm;
+using namespace haste;
+
+static const size_t width = 32;
+static const size_t height = 24;
+
+struct DenoiseImage {
+    vector<vec4> data = vector<vec4>(width * height, vec4(0.0f));
+    vector<vec4> albedo = vector<vec4>(width * height, vec4(0.0f));
+    vector<vec4> normal = vector<vec4>(width * height, vec4(0.0f));
+    vector<float> moments = vector<float>(width * height, 0.0f);
+
+    ImageView view() {
+        ImageView view(data.data(), width, height);
+        view._albedo = albedo.data();
+        view._normal = normal.data();
+        view._moments = moments.data();
+        return view;
+    }
+
+    void add(size_t i, const vec3& radiance, const vec3& surfaceAlbedo) {
+        float intensity = (radiance.x + radiance.y + radiance.z) / 3.0f;
+        data[i] += vec4(radiance, 1.0f);
+        albedo[i] += vec4(surfaceAlbedo, 1.0f);
+        normal[i] += vec4(0.0f, 0.0f, 1.0f, 2.0f);
+        moments[i] += intensity * intensity;
+    }
+};
+
+// Samples of a flat wall with the given albedo lit by a constant irradiance.
+static DenoiseImage makeNoisy(float scale, const vec3& albedo, size_t numSamples) {
+    RandomEngine engine(3);
+    DenoiseImage image;
+
+    for (size_t i = 0; i < width * height; ++i) {
+        for (size_t j = 0; j < numSamples; ++j) {
+            image.add(i, albedo * 2.0f * scale * engine.random1(), albedo);
+        }
+    }
+
+    return image;
+}
+
+static float intensity(const vec4& pixel) {
+    return (pixel.x + pixel.y + pixel.z) / (3.0f * pixel.w);
+}
+
+static float spread(const vector<vec4>& pixels) {
+    float mean = 0.0f, square = 0.0f;
+
+    for (auto& pixel : pixels) {
+        mean += intensity(pixel);
+        square += intensity(pixel) * intensity(pixel);
+    }
+
+    mean /= pixels.size();
+    return sqrt(max(square / pixels.size() - mean * mean, 0.0f));
+}
+
+TEST(DenoiserTest, constant_image_stays_constant) {
+    DenoiseImage image;
+
+    for (size_t i = 0; i < width * height; ++i) {
+        for (size_t j = 0; j < 4; ++j) {
+            image.add(i, vec3(0.2f, 0.4f, 0.3f), vec3(0.4f, 0.8f, 0.6f));
+        }
+    }
+
+    vector<vec4> result(width * height);
+    denoise(result.data(), image.view());
+
+    for (size_t i = 0; i < width * height; ++i) {
+        EXPECT_VEC3_EQ(vec3(0.2f, 0.4f, 0.3f), vec3(result[i]), 0.0001f);
+        EXPECT_EQ(1.0f, result[i].w);
+    }
+}
+
+TEST(DenoiserTest, reduces_noise) {
+    DenoiseImage image = makeNoisy(1.0f, vec3(0.5f), 4);
+
+    vector<vec4> result(width * height);
+    denoise(result.data(), image.view());
+
+    EXPECT_LT(spread(result), spread(image.data) * 0.5f);
+    EXPECT_NEAR(0.5f, intensity(result[width * height / 2 + width / 2]), 0.1f);
+}
+
+TEST(DenoiserTest, independent_of_albedo_scale) {
+    // The same irradiance under a dark and a bright albedo filters the same.
+    DenoiseImage dark = makeNoisy(1.0f, vec3(0.1f), 4);
+    DenoiseImage bright = makeNoisy(1.0f, vec3(0.8f), 4);
+
+    vector<vec4> darkResult(width * height);
+    vector<vec4> brightResult(width * height);
+    denoise(darkResult.data(), dark.view());
+    denoise(brightResult.data(), bright.view());
+
+    for (size_t i = 0; i < width * height; ++i) {
+        EXPECT_NEAR(intensity(darkResult[i]) * 8.0f, intensity(brightResult[i]), 0.001f);
+    }
+}
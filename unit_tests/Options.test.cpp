@@ -81,4 +81,169 @@ TEST(OptionsTest, basic_tests) {
     EXPECT_FALSE(x6.displayHelp);
     EXPECT_EQ(100, x6.width);
     EXPECT_EQ(200, x6.height);
+    EXPECT_FALSE(x6.compressMeshes);
+
+    Options x7 = parseArgs2(
+        "",
+        "foo",
+        "--compress-meshes");
+
+    EXPECT_FALSE(x7.displayHelp);
+    EXPECT_TRUE(x7.compressMeshes);
+    EXPECT_FALSE(x7.sceneCache);
+
+    Options x8 = parseArgs2(
+        "",
+        "foo",
+        "--scene-cache");
+
+    EXPECT_FALSE(x8.displayHelp);
+    EXPECT_TRUE(x8.sceneCache);
+
+    Options x9 = parseArgs2(
+        "",
+        "foo",
+        "--ReSTIR",
+        "--num-candidates=8",
+        "--spatial-reuse",
+        "--temporal-reuse");
+
+    EXPECT_FALSE(x9.displayHelp);
+    EXPECT_EQ(Options::ReSTIR, x9.technique);
+    EXPECT_EQ(8, x9.numCandidates);
+    EXPECT_TRUE(x9.spatialReuse);
+    EXPECT_TRUE(x9.temporalReuse);
+
+    Options x10 = parseArgs2(
+        "",
+        "foo",
+        "--ReSTIR",
+        "--batch",
+        "--temporal-reuse");
+
+    EXPECT_TRUE(x10.displayHelp);
+
+    Options x11 = parseArgs2(
+        "",
+        "foo",
+        "--nee-samples=4");
+
+    EXPECT_FALSE(x11.displayHelp);
+    EXPECT_EQ(4, x11.numLightSamples);
+
+    Options x12 = parseArgs2(
+        "",
+        "foo",
+        "--DI",
+        "--preview");
+
+    EXPECT_FALSE(x12.displayHelp);
+    EXPECT_EQ(Options::DI, x12.technique);
+    EXPECT_TRUE(x12.preview);
+
+    Options x13 = parseArgs2(
+        "",
+        "foo",
+        "--batch",
+        "--preview");
+
+    EXPECT_TRUE(x13.displayHelp);
+
+    Options x14 = parseArgs2(
+        "",
+        "foo",
+        "--half-float",
+        "--snapshot=16");
+
+    EXPECT_FALSE(x14.displayHelp);
+    EXPECT_TRUE(x14.halfFloat);
+    EXPECT_EQ(16, x14.snapshot);
+
+    Options x15 = parseArgs2(
+        "",
+        "foo",
+        "--batch",
+        "--num-samples=64",
+        "--tile-size=256");
+
+    EXPECT_FALSE(x15.displayHelp);
+    EXPECT_EQ(256, x15.tileSize);
+
+    Options x16 = parseArgs2(
+        "",
+        "foo",
+        "--batch",
+        "--tile-size=256");
+
+    EXPECT_TRUE(x16.displayHelp);
+
+    Options x17 = parseArgs2(
+        "",
+        "foo",
+        "--aovs");
+
+    EXPECT_FALSE(x17.displayHelp);
+    EXPECT_TRUE(x17.features);
+
+    Options x18 = parseArgs2(
+        "",
+        "foo",
+        "--denoise");
+
+    EXPECT_FALSE(x18.displayHelp);
+    EXPECT_TRUE(x18.denoise);
+    EXPECT_TRUE(x18.features);
+
+    Options x19 = parseArgs2(
+        "",
+        "foo",
+        "--batch",
+        "--checkpoint=600",
+        "--resume");
+
+    EXPECT_FALSE(x19.displayHelp);
+    EXPECT_EQ(600.0, x19.checkpoint);
+    EXPECT_TRUE(x19.resume);
+
+    Options x20 = parseArgs2(
+        "",
+        "foo",
+        "--resume");
+
+    EXPECT_TRUE(x20.displayHelp);
+
+    Options x21 = parseArgs2(
+        "",
+        "foo",
+        "--BPT",
+        "--roulette=0.25",
+        "--min-survival=0.05");
+
+    EXPECT_FALSE(x21.displayHelp);
+    EXPECT_EQ(0.25, x21.roulette);
+    EXPECT_EQ(0.05, x21.minSurvival);
+
+    Options x22 = parseArgs2(
+        "",
+        "foo",
+        "--PT");
+
+    EXPECT_FALSE(x22.displayHelp);
+    EXPECT_EQ(0.5, x22.roulette);
+    EXPECT_EQ(0.1, x22.minSurvival);
+
+    Options x23 = parseArgs2(
+        "",
+        "foo",
+        "--PM",
+        "--min-survival=0.05");
+
+    EXPECT_TRUE(x23.displayHelp);
+
+    Options x24 = parseArgs2(
+        "",
+        "foo",
+        "--min-survival=0");
+
+    EXPECT_TRUE(x24.displayHelp);
 }
@@ -0,0 +1,87 @@
+#include <gtest>
+#include <Roulette.hpp>
+
+using namespace glm;
+using namespace haste;
+
+TEST(RouletteTest, short_and_long_subpaths) {
+    Roulette roulette(3, 0.5f, 0.1f, true);
+
+    EXPECT_EQ(1.0f, roulette.expected(vec3(0.0f), 1.0f, 2));
+    EXPECT_EQ(1.0f, roulette.expected(vec3(100.0f), 1.0f, 2));
+    EXPECT_EQ(0.0f, roulette.expected(vec3(1.0f), 1.0f, 1024));
+    EXPECT_EQ(0.0f, roulette.expected(1024));
+}
+
+TEST(RouletteTest, window_bounds) {
+    Roulette roulette(0, 0.5f, 0.1f, false);
+
+    // Inside the window paths neither end nor split.
+    EXPECT_EQ(1.0f, roulette.expected(vec3(0.34f), 1.0f, 5));
+    EXPECT_EQ(1.0f, roulette.expected(vec3(1.0f), 1.0f, 5));
+    EXPECT_EQ(1.0f, roulette.expected(vec3(1.66f), 1.0f, 5));
+
+    // Below it they survive with the ratio, the scale is applied.
+    EXPECT_FLOAT_EQ(0.25f, roulette.expected(vec3(0.25f), 1.0f, 5));
+    EXPECT_FLOAT_EQ(0.25f, roulette.expected(vec3(0.5f), 0.5f, 5));
+    EXPECT_FLOAT_EQ(0.25f, roulette.expected(vec3(0.75f, 0.0f, 0.0f), 1.0f, 5));
+
+    // The minimal survival bounds the weights, black paths end.
+    EXPECT_FLOAT_EQ(0.1f, roulette.expected(vec3(0.01f), 1.0f, 5));
+    EXPECT_EQ(0.0f, roulette.expected(vec3(0.0f), 1.0f, 5));
+
+    // Above it only splitting changes the expectation.
+    EXPECT_EQ(1.0f, roulette.expected(vec3(4.0f), 1.0f, 5));
+}
+
+TEST(RouletteTest, survival_coefficient_without_estimate) {
+    Roulette roulette(3, 0.5f, 0.1f, true);
+
+    EXPECT_EQ(0.5f, roulette.expected(vec3(0.01f), 0.0f, 5));
+    EXPECT_EQ(0.5f, roulette.expected(vec3(100.0f), 0.0f, 5));
+    EXPECT_EQ(0.5f, roulette.expected(5));
+    EXPECT_EQ(1.0f, roulette.expected(2));
+}
+
+TEST(RouletteTest, split_cap) {
+    Roulette roulette(0, 0.5f, 0.1f, true);
+
+    EXPECT_FLOAT_EQ(2.0f, roulette.expected(vec3(2.0f), 1.0f, 5));
+    EXPECT_FLOAT_EQ(3.5f, roulette.expected(vec3(1.75f), 2.0f, 5));
+    EXPECT_EQ(8.0f, roulette.expected(vec3(100.0f), 1.0f, 5));
+}
+
+TEST(RouletteTest, sample_expected_value) {
+    RandomEngine engine(1);
+
+    const float expectations[] = { 0.0f, 0.1f, 0.5f, 1.0f, 2.25f, 7.9f, 8.0f };
+    const size_t numSamples = 100000;
+
+    for (float expected : expectations) {
+        const size_t whole = size_t(floor(expected));
+        size_t sum = 0;
+
+        for (size_t i = 0; i < numSamples; ++i) {
+            size_t sample = Roulette::sample(engine, expected);
+            ASSERT_TRUE(sample == whole || sample == whole + 1);
+            sum += sample;
+        }
+
+        EXPECT_NEAR(expected, float(sum) / numSamples, 0.01f);
+    }
+}
+
+TEST(RouletteTest, pixel_scale) {
+    // No estimate yet.
+    EXPECT_EQ(0.0f, Roulette::pixelScale(vec4(0.0f), 1.0f));
+    EXPECT_EQ(0.0f, Roulette::pixelScale(vec4(0.0f, 0.0f, 0.0f, 4.0f), 1.0f));
+    EXPECT_EQ(0.0f, Roulette::pixelScale(vec4(1.0f, 1.0f, 1.0f, 4.0f), 0.0f));
+
+    // Mean over the average of the pixel.
+    EXPECT_FLOAT_EQ(2.0f, Roulette::pixelScale(vec4(1.0f, 0.5f, 0.5f, 4.0f), 1.0f));
+    EXPECT_FLOAT_EQ(0.5f, Roulette::pixelScale(vec4(2.0f, 2.0f, 4.0f, 4.0f), 1.0f));
+
+    // Clamped to [1/8, 8].
+    EXPECT_FLOAT_EQ(8.0f, Roulette::pixelScale(vec4(0.01f, 0.0f, 0.0f, 1.0f), 1.0f));
+    EXPECT_FLOAT_EQ(0.125f, Roulette::pixelScale(vec4(100.0f, 0.0f, 0.0f, 1.0f), 1.0f));
+}
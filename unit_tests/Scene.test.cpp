@@ -0,0 +1,165 @@
+#include <gtest>
+#include <Scene.hpp>
+#include <glm/gtx/transform.hpp>
+
+using namespace glm;
+using namespace haste;
+
+static Mesh makeTriangle(const mat4& transform) {
+    const mat3 normalTransform = transpose(inverse(mat3(transform)));
+
+    Mesh mesh;
+    mesh.materialID = 0;
+    mesh.indices = { 0, 1, 2 };
+
+    const vec3 vertices[3] = {
+        vec3(0.0f, 0.0f, 0.0f),
+        vec3(1.0f, 0.0f, 0.0f),
+        vec3(0.0f, 1.0f, 0.0f) };
+
+    // Tilted from the geometric normal, but the same at every vertex, so the
+    // interpolation commutes with the transform.
+    const vec3 normal = normalize(vec3(0.2f, 0.3f, 1.0f));
+
+    for (size_t i = 0; i < 3; ++i) {
+        mesh.vertices.push_back(vec3(transform * vec4(vertices[i], 1.0f)));
+        mesh.normals.push_back(normalize(normalTransform * normal));
+        mesh.tangents.push_back(normalize(mat3(transform) * vec3(1.0f, 0.0f, 0.0f)));
+        mesh.bitangents.push_back(normalize(cross(mesh.normals[i], mesh.tangents[i])));
+    }
+
+    return mesh;
+}
+
+static Materials makeMaterials(const vec3& diffuse = vec3(0.5f), float ior = 1.5f) {
+    Materials materials;
+    materials.names.push_back("diffuse");
+    materials.diffuses.push_back(diffuse);
+    materials.emissives.push_back(vec3(0.0f));
+    materials.speculars.push_back(vec3(0.0f));
+    materials.iors.push_back(ior);
+    materials.bsdfs.push_back(unique<BSDF>(new DiffuseBSDF(diffuse)));
+    return materials;
+}
+
+struct SceneParams {
+    vec3 camera = vec3(0.0f, 0.0f, 5.0f);
+    vec3 diffuse = vec3(0.5f);
+    float ior = 1.5f;
+    vec3 offset = vec3(0.0f);
+    size_t numMeshes = 1;
+};
+
+static shared<Scene> makeScene(const SceneParams& params) {
+    Cameras cameras;
+    cameras.addCameraFovX(
+        "camera",
+        params.camera,
+        vec3(0.0f, 0.0f, -1.0f),
+        vec3(0.0f, 1.0f, 0.0f),
+        half_pi<float>());
+
+    vector<Mesh> meshes;
+
+    for (size_t i = 0; i < params.numMeshes; ++i) {
+        meshes.push_back(makeTriangle(translate(params.offset + vec3(float(i), 0.0f, 0.0f))));
+    }
+
+    return make_shared<Scene>(
+        move(cameras),
+        makeMaterials(params.diffuse, params.ior),
+        move(meshes),
+        vector<Instance>(),
+        AreaLights());
+}
+
+TEST(SceneTest, instance_matches_baked_copy) {
+    const mat4 transform =
+        translate(vec3(1.0f, -2.0f, 3.0f)) *
+        rotate(0.7f, normalize(vec3(1.0f, 2.0f, 0.5f))) *
+        scale(vec3(2.0f, 0.5f, 3.0f));
+
+    // The baked copy is moved aside, so it doesn't occlude the instance.
+    const vec3 offset = vec3(100.0f, 0.0f, 0.0f);
+
+    vector<Mesh> meshes;
+    meshes.push_back(makeTriangle(translate(offset) * transform));
+    meshes.push_back(makeTriangle(mat4(1.0f)));
+    meshes.back().instanced = true;
+
+    vector<Instance> instances(1);
+    instances[0].meshId = 1;
+    instances[0].transform = transform;
+
+    RTCDevice device = rtcNewDevice(nullptr);
+    Scene scene(Cameras(), makeMaterials(), move(meshes), move(instances), AreaLights());
+    scene.buildAccelStructs(device);
+
+    const vec3 target = vec3(transform * vec4(0.25f, 0.3f, 0.0f, 1.0f));
+    const vec3 origin = target + normalize(vec3(0.3f, -0.2f, 1.0f)) * 5.0f;
+
+    RayIsect instanced = scene.intersect(origin, target - origin);
+    RayIsect baked = scene.intersect(origin + offset, target - origin);
+
+    ASSERT_TRUE(instanced.isMesh());
+    ASSERT_TRUE(baked.isMesh());
+    EXPECT_EQ(1, instanced.meshId());
+    EXPECT_EQ(0, baked.meshId());
+
+    EXPECT_VEC3_EQ(target, instanced.position(), 0.0001f);
+    EXPECT_VEC3_EQ(baked.position() - offset, instanced.position(), 0.0001f);
+    EXPECT_VEC3_EQ(baked.gnormal(), instanced.gnormal(), 0.0001f);
+
+    SurfacePoint a = scene.querySurface(instanced);
+    SurfacePoint b = scene.querySurface(baked);
+
+    EXPECT_VEC3_EQ(b.position() - offset, a.position(), 0.0001f);
+    EXPECT_VEC3_EQ(b.normal(), a.normal(), 0.0001f);
+    EXPECT_VEC3_EQ(b.tangent(), a.tangent(), 0.0001f);
+    EXPECT_VEC3_EQ(
+        normalize(scene.lerpNormal(baked)),
+        normalize(scene.lerpNormal(instanced)),
+        0.0001f);
+}
+
+TEST(SceneTest, diff_unchanged) {
+    SceneParams params;
+    EXPECT_EQ(SceneChangeNone, makeScene(params)->diff(*makeScene(params)));
+}
+
+TEST(SceneTest, diff_cameras_only) {
+    SceneParams params;
+    auto scene = makeScene(params);
+
+    params.camera = vec3(1.0f, 0.0f, 5.0f);
+    EXPECT_EQ(SceneChangeCameras, scene->diff(*makeScene(params)));
+}
+
+TEST(SceneTest, diff_materials_only) {
+    SceneParams params;
+    auto scene = makeScene(params);
+
+    params.diffuse = vec3(0.25f);
+    EXPECT_EQ(SceneChangeMaterials, scene->diff(*makeScene(params)));
+
+    params = SceneParams();
+    params.ior = 1.33f;
+    EXPECT_EQ(SceneChangeMaterials, scene->diff(*makeScene(params)));
+}
+
+TEST(SceneTest, diff_vertices) {
+    SceneParams params;
+    auto scene = makeScene(params);
+
+    params.offset = vec3(0.0f, 1.0f, 0.0f);
+    EXPECT_EQ(SceneChangeVertices, scene->diff(*makeScene(params)));
+}
+
+TEST(SceneTest, diff_topology) {
+    SceneParams params;
+    auto scene = makeScene(params);
+
+    params.numMeshes = 2;
+    params.camera = vec3(1.0f, 0.0f, 5.0f);
+    EXPECT_TRUE(scene->diff(*makeScene(params)) & SceneChangeTopology);
+}
@@ -0,0 +1,177 @@
+#include <gtest>
+#include <SceneCache.hpp>
+#include <cstdio>
+#include <fstream>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace glm;
+using namespace haste;
+
+static const string source = "SceneCache.test.obj";
+
+static SceneDesc makeDesc() {
+    SceneDesc desc;
+
+    desc.cameras.addCameraFovX(
+        "camera",
+        vec3(0.0f, 1.0f, 5.0f),
+        vec3(0.0f, 0.0f, -1.0f),
+        vec3(0.0f, 1.0f, 0.0f),
+        1.0f);
+
+    MaterialDesc material;
+    material.name = "glass";
+    material.diffuse = vec3(0.1f, 0.2f, 0.3f);
+    material.specular = vec3(1.0f);
+    material.bsdf = MaterialBSDFTransmission;
+    material.ior = 1.5f;
+    desc.materials.push_back(material);
+
+    Mesh mesh;
+    mesh.name = "triangle";
+    mesh.materialID = 0;
+    mesh.instanced = true;
+    mesh.indices = { 0, 1, 2 };
+    mesh.vertices = { vec3(0.0f), vec3(1.0f, 0.0f, 0.0f), vec3(0.0f, 1.0f, 0.0f) };
+    mesh.normals.assign(3, vec3(0.0f, 0.0f, 1.0f));
+    mesh.tangents.assign(3, vec3(1.0f, 0.0f, 0.0f));
+    mesh.bitangents.assign(3, vec3(0.0f, 1.0f, 0.0f));
+    desc.meshes.push_back(mesh);
+
+    Instance instance;
+    instance.meshId = 0;
+    instance.transform = mat4(2.0f);
+    desc.instances.push_back(instance);
+
+    desc.lights.addLight(
+        "emitter",
+        vec3(0.0f, 2.0f, 0.0f),
+        vec3(1.0f, 2.0f, 0.0f),
+        vec3(0.0f, 2.0f, 1.0f),
+        vec3(4.0f));
+
+    return desc;
+}
+
+static void writeSource(const string& content) {
+    std::ofstream(source, std::ios::binary) << content;
+}
+
+static vector<char> readCache() {
+    std::ifstream stream(sceneCachePath(source), std::ios::binary);
+    return vector<char>(std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>());
+}
+
+static void writeCache(const vector<char>& data) {
+    std::ofstream(sceneCachePath(source), std::ios::binary).write(data.data(), data.size());
+}
+
+static void cleanup() {
+    std::remove(source.c_str());
+    std::remove(sceneCachePath(source).c_str());
+}
+
+TEST(SceneCache, round_trip) {
+    writeSource("v 0 0 0\n");
+    writeSceneCache(source, makeDesc());
+
+    SceneDesc desc;
+    ASSERT_TRUE(readSceneCache(desc, source));
+
+    ASSERT_EQ(1, desc.cameras.numCameras());
+    EXPECT_EQ("camera", desc.cameras.name(0));
+    EXPECT_VEC3_EQ(vec3(0.0f, 1.0f, 5.0f), desc.cameras.position(0), 0.00001f);
+
+    ASSERT_EQ(1, desc.materials.size());
+    EXPECT_EQ("glass", desc.materials[0].name);
+    EXPECT_EQ(MaterialBSDFTransmission, desc.materials[0].bsdf);
+    EXPECT_FLOAT_EQ(1.5f, desc.materials[0].ior);
+
+    ASSERT_EQ(1, desc.meshes.size());
+    EXPECT_EQ("triangle", desc.meshes[0].name);
+    EXPECT_TRUE(desc.meshes[0].instanced);
+    EXPECT_EQ(makeDesc().meshes[0].indices, desc.meshes[0].indices);
+    EXPECT_EQ(makeDesc().meshes[0].vertices, desc.meshes[0].vertices);
+    EXPECT_EQ(makeDesc().meshes[0].normals, desc.meshes[0].normals);
+
+    ASSERT_EQ(1, desc.instances.size());
+    EXPECT_TRUE(desc.instances[0].transform == mat4(2.0f));
+
+    ASSERT_EQ(1, desc.lights.numLights());
+    EXPECT_EQ("emitter", desc.lights.name(0));
+    EXPECT_TRUE(desc.lights.isTriangle(0));
+
+    cleanup();
+}
+
+TEST(SceneCache, rejects_wrong_version) {
+    writeSource("v 0 0 0\n");
+    writeSceneCache(source, makeDesc());
+
+    vector<char> data = readCache();
+    ASSERT_GT(data.size(), 8);
+    data[4] ^= 0x40; // the version follows the magic
+    writeCache(data);
+
+    SceneDesc desc;
+    EXPECT_FALSE(readSceneCache(desc, source));
+    EXPECT_EQ(0, desc.meshes.size());
+
+    cleanup();
+}
+
+TEST(SceneCache, rejects_truncated) {
+    writeSource("v 0 0 0\n");
+    writeSceneCache(source, makeDesc());
+
+    vector<char> data = readCache();
+
+    for (size_t size : { size_t(0), size_t(3), data.size() / 2, data.size() - 1 }) {
+        writeCache(vector<char>(data.begin(), data.begin() + size));
+
+        SceneDesc desc;
+        EXPECT_FALSE(readSceneCache(desc, source)) << size;
+    }
+
+    cleanup();
+}
+
+TEST(SceneCache, rejects_modified_source) {
+    writeSource("v 0 0 0\n");
+    writeSceneCache(source, makeDesc());
+
+    // Same size, saved within the same second.
+    struct stat before;
+    ASSERT_EQ(0, stat(source.c_str(), &before));
+    writeSource("v 1 0 0\n");
+
+    struct timespec times[2] = { before.st_atim, before.st_mtim };
+    times[1].tv_nsec = (times[1].tv_nsec + 1) % 1000000000;
+    ASSERT_EQ(0, utimensat(AT_FDCWD, source.c_str(), times, 0));
+
+    SceneDesc desc;
+    EXPECT_FALSE(readSceneCache(desc, source));
+
+    cleanup();
+}
+
+TEST(SceneCache, light_names_per_mesh) {
+    SceneDesc scene = makeDesc();
+    scene.lights.addLight("emitter", vec3(0.0f), vec3(1.0f, 0.0f, 0.0f), vec3(0.0f, 0.0f, 1.0f), vec3(1.0f));
+    scene.lights.addLight("other", vec3(0.0f), vec3(1.0f, 0.0f, 0.0f), vec3(0.0f, 0.0f, 1.0f), vec3(1.0f));
+    ASSERT_EQ(2, scene.lights._names.size());
+
+    writeSource("v 0 0 0\n");
+    writeSceneCache(source, scene);
+
+    SceneDesc desc;
+    ASSERT_TRUE(readSceneCache(desc, source));
+    ASSERT_EQ(3, desc.lights.numLights());
+    EXPECT_EQ(2, desc.lights._names.size());
+    EXPECT_EQ("emitter", desc.lights.name(1));
+    EXPECT_EQ("other", desc.lights.name(2));
+
+    cleanup();
+}
@@ -0,0 +1,95 @@
+#include <gtest>
+#include <PathTracing.hpp>
+
+using namespace glm;
+using namespace haste;
+
+static shared<Scene> makeRoom(RTCDevice device) {
+    Cameras cameras;
+    cameras.addCameraFovX(
+        "camera",
+        vec3(0.0f, 0.0f, 5.0f),
+        vec3(0.0f, 0.0f, -1.0f),
+        vec3(0.0f, 1.0f, 0.0f),
+        half_pi<float>());
+
+    Mesh floor;
+    floor.materialID = 0;
+    floor.indices = { 0, 1, 2, 0, 2, 3 };
+    floor.vertices = {
+        vec3(-10.0f, -10.0f, 0.0f),
+        vec3(10.0f, -10.0f, 0.0f),
+        vec3(10.0f, 10.0f, 0.0f),
+        vec3(-10.0f, 10.0f, 0.0f) };
+    floor.normals.assign(4, vec3(0.0f, 0.0f, 1.0f));
+    floor.tangents.assign(4, vec3(1.0f, 0.0f, 0.0f));
+    floor.bitangents.assign(4, vec3(0.0f, 1.0f, 0.0f));
+
+    vector<Mesh> meshes;
+    meshes.push_back(move(floor));
+
+    Materials materials;
+    materials.names.push_back("diffuse");
+    materials.diffuses.push_back(vec3(0.5f));
+    materials.emissives.push_back(vec3(0.0f));
+    materials.speculars.push_back(vec3(0.0f));
+    materials.iors.push_back(1.5f);
+    materials.bsdfs.push_back(unique<BSDF>(new DiffuseBSDF(vec3(0.5f))));
+
+    AreaLights lights;
+    lights.addLight(
+        "light",
+        vec3(0.0f, 0.0f, 2.0f),
+        vec3(0.0f, 0.0f, -1.0f),
+        vec3(0.0f, 1.0f, 0.0f),
+        vec3(10.0f),
+        vec2(1.0f));
+
+    auto scene = make_shared<Scene>(
+        move(cameras),
+        move(materials),
+        move(meshes),
+        vector<Instance>(),
+        move(lights));
+
+    scene->buildAccelStructs(device);
+    return scene;
+}
+
+TEST(TechniqueTest, features_keep_radiance_stream) {
+    const size_t width = 8, height = 6;
+
+    RTCDevice device = rtcNewDevice(nullptr);
+    auto scene = makeRoom(device);
+
+    vector<vec4> plain(width * height, vec4(0.0f));
+    vector<vec4> image(width * height, vec4(0.0f));
+    vector<vec4> albedo(width * height, vec4(0.0f));
+    vector<vec4> normal(width * height, vec4(0.0f));
+    vector<float> moments(width * height, 0.0f);
+
+    ImageView plainView(plain.data(), width, height);
+    ImageView view(image.data(), width, height);
+    view._albedo = albedo.data();
+    view._normal = normal.data();
+    view._moments = moments.data();
+
+    PathTracing pathTracing;
+    Technique& technique = pathTracing;
+    RandomEngine engine;
+    technique.preprocess(scene, engine, [](string, float) { });
+
+    for (size_t pass = 0; pass < 2; ++pass) {
+        RandomEngine a(7 + pass), b(7 + pass);
+        technique.render(plainView, a, 0, false);
+        technique.render(view, b, 0, false);
+    }
+
+    for (size_t i = 0; i < width * height; ++i) {
+        EXPECT_EQ(plain[i], image[i]);
+        EXPECT_EQ(2.0f, albedo[i].w);
+    }
+
+    EXPECT_GT(image[width * height / 2].x, 0.0f);
+    EXPECT_VEC3_EQ(vec3(0.5f), vec3(albedo[width * height / 2]) / 2.0f, 0.00001f);
+}
@@ -0,0 +1,86 @@
+#include <gtest>
+#include <loader.hpp>
+#include <cstdio>
+#include <fstream>
+
+using namespace glm;
+using namespace haste;
+
+static SceneDesc importOBJString(const string& source) {
+    const string path = "loader.test.obj";
+    std::ofstream(path, std::ios::binary) << source;
+    SceneDesc desc = importOBJ(path);
+    std::remove(path.c_str());
+    return desc;
+}
+
+TEST(OBJLoader, single_triangle) {
+    SceneDesc desc = importOBJString(
+        "v 0 0 0\n"
+        "v 1 0 0\n"
+        "v 0 1 0\n"
+        "vn 0 0 1\n"
+        "f 1//1 2//1 3//1\n");
+
+    ASSERT_EQ(1, desc.meshes.size());
+    EXPECT_EQ(3, desc.meshes[0].indices.size());
+    ASSERT_EQ(3, desc.meshes[0].vertices.size());
+    EXPECT_VEC3_EQ(vec3(1.0f, 0.0f, 0.0f), desc.meshes[0].vertices[1], 0.0001f);
+}
+
+TEST(OBJLoader, incomplete_lines_at_end) {
+    // Lines without coordinates are elements too, at the end of the file
+    // they have to be counted as well.
+    SceneDesc desc = importOBJString(
+        "v 0 0 0\n"
+        "v 1 0 0\n"
+        "v 0 1 0\n"
+        "vn 0 0 1\n"
+        "f -3//1 -2//1 -1//1\n"
+        "vn\n"
+        "v");
+
+    ASSERT_EQ(1, desc.meshes.size());
+    EXPECT_EQ(3, desc.meshes[0].indices.size());
+}
+
+TEST(OBJLoader, crlf_and_tabs) {
+    SceneDesc desc = importOBJString(
+        "v\t0 0 0\r\n"
+        "  v 1 0 0\r\n"
+        "v 0 1 0 # comment\r\n"
+        "v\r\n"
+        "vn\r\n"
+        "f 1 2 3 4\r\n");
+
+    ASSERT_EQ(1, desc.meshes.size());
+    EXPECT_EQ(6, desc.meshes[0].indices.size());
+}
+
+TEST(OBJLoader, tangent_frames_keep_vertices_shared) {
+    // A fan around a shared corner, every face has a different first edge.
+    SceneDesc desc = importOBJString(
+        "v 0 0 0\n"
+        "v 1 0 0\n"
+        "v 0 1 0\n"
+        "v -1 0 0\n"
+        "v 0 -1 0\n"
+        "vn 0 0 1\n"
+        "f 1//1 2//1 3//1\n"
+        "f 3//1 4//1 1//1\n"
+        "f 1//1 4//1 5//1\n"
+        "f 5//1 2//1 1//1\n");
+
+    ASSERT_EQ(1, desc.meshes.size());
+    const Mesh& mesh = desc.meshes[0];
+
+    EXPECT_EQ(5, mesh.vertices.size());
+    ASSERT_EQ(mesh.vertices.size(), mesh.tangents.size());
+    ASSERT_EQ(mesh.vertices.size(), mesh.bitangents.size());
+
+    for (size_t i = 0; i < mesh.vertices.size(); ++i) {
+        EXPECT_NEAR(0.0f, dot(mesh.normals[i], mesh.tangents[i]), 0.0001f);
+        EXPECT_NEAR(1.0f, length(mesh.tangents[i]), 0.0001f);
+        EXPECT_NEAR(0.0f, dot(mesh.tangents[i], mesh.bitangents[i]), 0.0001f);
+    }
+}
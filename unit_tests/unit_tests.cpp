@@ -16,3 +16,36 @@ TEST(NANTest, main) {
     EXPECT_TRUE(std::isnan(-0.0f / 0.0f));
 }
 
+TEST(OctahedralTest, round_trip) {
+    const vec3 directions[] = {
+        vec3(0.0f, 0.0f, 1.0f),
+        vec3(0.0f, 0.0f, -1.0f),
+        vec3(1.0f, 0.0f, 0.0f),
+        vec3(0.0f, -1.0f, 0.0f),
+        normalize(vec3(1.0f, 2.0f, -3.0f)),
+        normalize(vec3(-0.3f, 0.1f, -0.9f)),
+    };
+
+    for (auto& direction : directions) {
+        vec3 decoded = decodeOctahedral(encodeOctahedral(direction));
+        EXPECT_NEAR(1.0f, length(decoded), 0.00001f);
+        EXPECT_NEAR(1.0f, dot(direction, decoded), 0.00001f);
+    }
+}
+
+TEST(AliasTableTest, distribution) {
+    const float weights[] = { 1.0f, 0.0f, 3.0f, 4.0f };
+    AliasTable table(weights, weights + 4);
+
+    const size_t numSamples = 80000;
+    size_t counts[4] = { 0, 0, 0, 0 };
+
+    for (size_t i = 0; i < numSamples; ++i) {
+        ++counts[table.sample((float(i) + 0.5f) / float(numSamples))];
+    }
+
+    EXPECT_NEAR(0.125f, float(counts[0]) / numSamples, 0.001f);
+    EXPECT_EQ(0u, counts[1]);
+    EXPECT_NEAR(0.375f, float(counts[2]) / numSamples, 0.001f);
+    EXPECT_NEAR(0.5f, float(counts[3]) / numSamples, 0.001f);
+}
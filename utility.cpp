@@ -1,122 +1,318 @@
 #include <runtime_assert>
 #include <utility.hpp>
+#include <chrono>
 
 namespace haste {
 
-UniformSampler::UniformSampler() {
-    std::random_device device;
-    engine.seed(device());
-}
+AliasTable::AliasTable() { }
 
-float UniformSampler::sample() {
-    return std::uniform_real_distribution<float>()(engine);
-}
+AliasTable::AliasTable(const float* weightsBegin, const float* weightsEnd) {
+    const size_t size = weightsEnd - weightsBegin;
+
+    double total = 0.0;
+
+    for (size_t i = 0; i < size; ++i) {
+        total += weightsBegin[i];
+    }
+
+    runtime_assert(size != 0 && total > 0.0);
+
+    _probabilities.resize(size);
+    _aliases.resize(size);
+
+    vector<double> scaled(size);
+    vector<uint32_t> small, large;
+
+    for (size_t i = 0; i < size; ++i) {
+        scaled[i] = weightsBegin[i] * size / total;
+        (scaled[i] < 1.0 ? small : large).push_back(uint32_t(i));
+    }
+
+    while (!small.empty() && !large.empty()) {
+        uint32_t less = small.back();
+        uint32_t more = large.back();
+        small.pop_back();
+
+        _probabilities[less] = float(scaled[less]);
+        _aliases[less] = more;
 
-PiecewiseSampler::PiecewiseSampler() { }
+        scaled[more] -= 1.0 - scaled[less];
 
-PiecewiseSampler::PiecewiseSampler(const float* weightsBegin, const float* weightsEnd) {
-    std::random_device device;
-    engine.seed(device());
+        if (scaled[more] < 1.0) {
+            large.pop_back();
+            small.push_back(more);
+        }
+    }
 
-    size_t numWeights = weightsEnd - weightsBegin;
+    // Leftovers differ from 1 only by rounding errors.
+    for (auto index : small) {
+        _probabilities[index] = 1.0f;
+        _aliases[index] = index;
+    }
+
+    for (auto index : large) {
+        _probabilities[index] = 1.0f;
+        _aliases[index] = index;
+    }
+}
 
-    auto lambda = [&](float x) {
-        return weightsBegin[min(size_t(x * numWeights), numWeights - 1)];
-    };
+size_t AliasTable::sample(float uniform) const {
+    const size_t size = _probabilities.size();
+    const float scaled = uniform * size;
+    const size_t index = min(size_t(scaled), size - 1);
 
-    distribution = std::piecewise_constant_distribution<float>(
-        numWeights,
-        0.f,
-        1.f,
-        lambda);
+    return scaled - float(index) < _probabilities[index] ? index : _aliases[index];
 }
 
-float PiecewiseSampler::sample() {
-    return distribution(engine);
+inline vec2 signNotZero(const vec2& v) {
+    return vec2(v.x >= 0.0f ? 1.0f : -1.0f, v.y >= 0.0f ? 1.0f : -1.0f);
 }
 
-vec3 BarycentricSampler::sample() {
-    float u = uniform.sample();
-    float v = uniform.sample();
+uint32_t encodeOctahedral(const vec3& unit) {
+    const float norm = abs(unit.x) + abs(unit.y) + abs(unit.z);
 
-    if (u + v <= 1) {
-        return vec3(u, v, 1 - u - v);
+    if (norm == 0.0f) {
+        return encodeOctahedral(vec3(0.0f, 0.0f, 1.0f));
     }
-    else {
-        return vec3(1 - u, 1 - v, u + v - 1);
+
+    vec2 p = vec2(unit.x, unit.y) / norm;
+
+    if (unit.z < 0.0f) {
+        p = (vec2(1.0f) - abs(vec2(p.y, p.x))) * signNotZero(p);
     }
+
+    const int x = int(round(clamp(p.x, -1.0f, 1.0f) * 32767.0f));
+    const int y = int(round(clamp(p.y, -1.0f, 1.0f) * 32767.0f));
+
+    return (uint32_t(x) & 0xFFFFu) | ((uint32_t(y) & 0xFFFFu) << 16);
+}
+
+vec3 decodeOctahedral(uint32_t packed) {
+    const vec2 p = vec2(
+        float(std::int16_t(packed & 0xFFFFu)),
+        float(std::int16_t(packed >> 16))) / 32767.0f;
+
+    vec3 result = vec3(p.x, p.y, 1.0f - abs(p.x) - abs(p.y));
+
+    if (result.z < 0.0f) {
+        const vec2 q = (vec2(1.0f) - abs(vec2(p.y, p.x))) * signNotZero(p);
+        result.x = q.x;
+        result.y = q.y;
+    }
+
+    return normalize(result);
 }
 
 }
 
 #include <ImfInputFile.h>
 #include <ImfOutputFile.h>
+#include <ImfTiledOutputFile.h>
 #include <ImfChannelList.h>
 #include <ImfStringAttribute.h>
 #include <ImfMatrixAttribute.h>
 #include <ImfArray.h>
+#include <ImfThreading.h>
+#include <thread>
 
 using namespace std;
 using namespace Imf;
 
 namespace haste {
 
-void saveEXR(
-    const string& path,
-    size_t widthll,
-    size_t heightll,
-    const vec3* data)
-{
-    runtime_assert(widthll < INT_MAX);
-    runtime_assert(heightll < INT_MAX);
+// Uses all cores for the compression of the lines, set once per process.
+void initEXRThreads() {
+    static const bool initialized = [] {
+        setGlobalThreadCount(int(std::thread::hardware_concurrency()));
+        return true;
+    }();
+
+    (void)initialized;
+}
 
-    const int width = int(widthll);
-    const int height = int(heightll);
+// Channels of the written files in the order they are interleaved in
+// memory, the features (layers of the file) are optional.
+static const char* const exrChannels[] = {
+    "R", "G", "B",
+    "albedo.R", "albedo.G", "albedo.B",
+    "normal.X", "normal.Y", "normal.Z",
+    "depth.Z"
+};
 
-    Header header (width, height);
-    header.channels().insert ("R", Channel (Imf::FLOAT));
-    header.channels().insert ("G", Channel (Imf::FLOAT));
-    header.channels().insert ("B", Channel (Imf::FLOAT));
+static const size_t numRadianceChannels = 3;
+static const size_t numFeatureChannels = 10;
 
-    OutputFile file (path.c_str(), header);
+Header exrHeader(size_t width, size_t height, size_t numChannels, bool halfFloat) {
+    runtime_assert(width < INT_MAX);
+    runtime_assert(height < INT_MAX);
 
-    FrameBuffer framebuffer;
+    const PixelType type = halfFloat ? Imf::HALF : Imf::FLOAT;
 
-    size_t size = width * height * 3;
-    vector<float> data_copy(size);
+    Header header ((int)width, (int)height);
 
-    for (size_t y = 0; y < height; ++y) {
-        ::memcpy(
-            data_copy.data() + y * width * 3,
-            data + (height - y - 1) * width,
-            width * sizeof(vec3));
+    for (size_t i = 0; i < numChannels; ++i) {
+        header.channels().insert (exrChannels[i], Channel (type));
     }
 
-    auto R = Slice(Imf::FLOAT, (char*)(data_copy.data() + 0), sizeof(float) * 3, sizeof(float) * width * 3);
-    auto G = Slice(Imf::FLOAT, (char*)(data_copy.data() + 1), sizeof(float) * 3, sizeof(float) * width * 3);
-    auto B = Slice(Imf::FLOAT, (char*)(data_copy.data() + 2), sizeof(float) * 3, sizeof(float) * width * 3);
+    return header;
+}
 
-    framebuffer.insert("R", R);
-    framebuffer.insert("G", G);
-    framebuffer.insert("B", B);
+// Rows [yBegin, yBegin + n) of the image are stored bottom up in data, file
+// row r is the image row height - r - 1. The slices address the data by
+// file coordinates with a negative y stride, so the flip needs no copy.
+// OpenEXR converts the floats to halves if required.
+FrameBuffer exrFrameBuffer(
+    const float* data,
+    size_t width,
+    size_t height,
+    size_t yBegin,
+    size_t numChannels)
+{
+    const ptrdiff_t rowSize = ptrdiff_t(sizeof(float) * numChannels * width);
+    const char* base = (const char*)data + ptrdiff_t(height - 1 - yBegin) * rowSize;
+    const size_t xStride = sizeof(float) * numChannels;
+    const size_t yStride = size_t(-rowSize);
 
-    file.setFrameBuffer(framebuffer);
-    file.writePixels(height);
+    FrameBuffer framebuffer;
+
+    for (size_t i = 0; i < numChannels; ++i) {
+        framebuffer.insert(
+            exrChannels[i],
+            Slice(Imf::FLOAT, (char*)base + i * sizeof(float), xStride, yStride));
+    }
+
+    return framebuffer;
+}
+
+// Divides the accumulated pixels by their weights in a single pass.
+void packEXRPixels(
+    vector<float>& dst,
+    size_t size,
+    const vec4* data,
+    const vec4* albedo,
+    const vec4* normal)
+{
+    const size_t numChannels = albedo ? numFeatureChannels : numRadianceChannels;
+
+    dst.resize(size * numChannels);
+
+    parallelChunks(size, [&](size_t i) {
+        float* pixel = dst.data() + i * numChannels;
+        const vec3 radiance = data[i].xyz() / data[i].w;
+
+        pixel[0] = radiance.x;
+        pixel[1] = radiance.y;
+        pixel[2] = radiance.z;
+
+        if (albedo) {
+            const float weight = albedo[i].w == 0.0f ? 0.0f : 1.0f / albedo[i].w;
+
+            for (size_t j = 0; j < 3; ++j) {
+                pixel[3 + j] = albedo[i][j] * weight;
+                pixel[6 + j] = normal[i][j] * weight;
+            }
+
+            pixel[9] = normal[i].w * weight;
+        }
+    });
 }
 
 void saveEXR(
     const string& path,
     size_t width,
     size_t height,
-    const vec4* data)
+    const vec3* data,
+    bool halfFloat)
 {
-    auto data3 = vector<vec3>(width * height);
+    initEXRThreads();
 
-    for (size_t i = 0; i < data3.size(); ++i) {
-        data3[i] = data[i].xyz() / data[i].w;
-    }
+    OutputFile file (path.c_str(), exrHeader(width, height, numRadianceChannels, halfFloat));
+    file.setFrameBuffer(exrFrameBuffer((const float*)data, width, height, 0, numRadianceChannels));
+    file.writePixels(int(height));
+}
+
+void saveEXR(
+    const string& path,
+    size_t width,
+    size_t height,
+    const vec4* data,
+    bool halfFloat)
+{
+    saveEXR(path, width, height, data, nullptr, nullptr, halfFloat);
+}
+
+void saveEXR(
+    const string& path,
+    size_t width,
+    size_t height,
+    const vec4* data,
+    const vec4* albedo,
+    const vec4* normal,
+    bool halfFloat)
+{
+    initEXRThreads();
+
+    const size_t numChannels = albedo ? numFeatureChannels : numRadianceChannels;
+
+    vector<float> pixels;
+    packEXRPixels(pixels, width * height, data, albedo, normal);
+
+    OutputFile file (path.c_str(), exrHeader(width, height, numChannels, halfFloat));
+    file.setFrameBuffer(exrFrameBuffer(pixels.data(), width, height, 0, numChannels));
+    file.writePixels(int(height));
+}
+
+TiledEXRWriter::TiledEXRWriter(
+    const string& path,
+    size_t width,
+    size_t height,
+    size_t tileSize,
+    bool features,
+    bool halfFloat)
+    : _width(width)
+    , _height(height)
+    , _tileSize(tileSize)
+    , _numChannels(features ? numFeatureChannels : numRadianceChannels)
+{
+    runtime_assert(tileSize != 0);
+
+    initEXRThreads();
+
+    Header header = exrHeader(width, height, _numChannels, halfFloat);
+    header.setTileDescription(TileDescription(tileSize, tileSize, ONE_LEVEL));
+
+    _file.reset(new TiledOutputFile(path.c_str(), header));
+}
+
+TiledEXRWriter::~TiledEXRWriter() { }
 
-    saveEXR(path, width, height, data3.data());
+size_t TiledEXRWriter::numTileRows() const {
+    return (_height + _tileSize - 1) / _tileSize;
+}
+
+size_t TiledEXRWriter::yBegin(size_t tileRow) const {
+    return _height - min(_height, (tileRow + 1) * _tileSize);
+}
+
+size_t TiledEXRWriter::yEnd(size_t tileRow) const {
+    return _height - tileRow * _tileSize;
+}
+
+void TiledEXRWriter::writeTileRow(
+    size_t tileRow,
+    const vec4* rows,
+    const vec4* albedo,
+    const vec4* normal)
+{
+    runtime_assert((albedo != nullptr) == (_numChannels == numFeatureChannels));
+
+    const size_t begin = yBegin(tileRow);
+    const size_t size = (yEnd(tileRow) - begin) * _width;
+
+    packEXRPixels(_scratch, size, rows, albedo, normal);
+
+    _file->setFrameBuffer(exrFrameBuffer(_scratch.data(), _width, _height, begin, _numChannels));
+    _file->writeTiles(0, _file->numXTiles() - 1, int(tileRow), int(tileRow));
 }
 
 void loadEXR(
@@ -128,14 +324,14 @@ void loadEXR(
     InputFile file (path.c_str());
 
     auto dw = file.header().dataWindow();
-    int ihegith = dw.max.x - dw.min.x + 1;
-    int iwidth = dw.max.y - dw.min.y + 1;
+    int iwidth = dw.max.x - dw.min.x + 1;
+    int iheight = dw.max.y - dw.min.y + 1;
 
     runtime_assert(iwidth >= 0);
-    runtime_assert(ihegith >= 0);
+    runtime_assert(iheight >= 0);
 
     width = size_t(iwidth);
-    height = size_t(ihegith);
+    height = size_t(iheight);
 
     FrameBuffer framebuffer;
 
@@ -351,4 +547,98 @@ size_t getmtime(const string& path) {
     return buf.st_mtime;
 }
 
+double secondsSinceStart() {
+    using clock = std::chrono::steady_clock;
+    static const clock::time_point start = clock::now();
+    return std::chrono::duration<double>(clock::now() - start).count();
+}
+
+}
+
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+namespace haste {
+
+MappedFile::MappedFile(const string& path) {
+    int fd = open(path.c_str(), O_RDONLY);
+
+    if (fd == -1) {
+        return;
+    }
+
+    struct stat buf;
+
+    if (fstat(fd, &buf) == 0 && buf.st_size != 0) {
+        void* data = mmap(nullptr, size_t(buf.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+
+        if (data != MAP_FAILED) {
+            madvise(data, size_t(buf.st_size), MADV_SEQUENTIAL);
+            _data = (const char*)data;
+            _size = size_t(buf.st_size);
+        }
+    }
+
+    close(fd);
+}
+
+MappedFile::~MappedFile() {
+    if (_data != nullptr) {
+        munmap((void*)_data, _size);
+    }
+}
+
+bool writeMappedFile(const string& path, size_t size, const function<void(char*)>& fill) {
+    string temp = path + "." + std::to_string(getpid());
+    int fd = open(temp.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+    if (fd == -1) {
+        return false;
+    }
+
+    bool written = false;
+
+    // The blocks are allocated up front, writing through the mapping into a
+    // sparse file would raise SIGBUS once the disk is full.
+    if (size != 0 && posix_fallocate(fd, 0, off_t(size)) == 0) {
+        void* data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+        if (data != MAP_FAILED) {
+            fill((char*)data);
+            written = msync(data, size, MS_SYNC) == 0;
+            munmap(data, size);
+        }
+    }
+
+    close(fd);
+
+    if (!written || std::rename(temp.c_str(), path.c_str()) != 0) {
+        std::remove(temp.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+void BinaryWriter::raw(const void* data, size_t size) {
+    if (_cursor != nullptr) {
+        std::memcpy(_cursor, data, size);
+        _cursor += size;
+    }
+
+    _size += size;
+}
+
+void BinaryReader::raw(void* dst, size_t size) {
+    if (!_good || size > size_t(_end - _cursor)) {
+        _good = false;
+        return;
+    }
+
+    std::memcpy(dst, _cursor, size);
+    _cursor += size;
+}
+
 }
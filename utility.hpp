@@ -1,9 +1,16 @@
 #pragma once
-#include <random>
+#include <cstdint>
 #include <functional>
+#include <memory>
 #include <string>
 #include <vector>
 #include <glm>
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+
+namespace Imf {
+class TiledOutputFile;
+}
 
 namespace haste {
 
@@ -11,44 +18,103 @@ using std::function;
 using std::vector;
 using std::string;
 using std::pair;
+using std::uint32_t;
 using namespace glm;
 
-class UniformSampler {
+// Walker's alias method, index i is drawn with probability proportional to
+// weights[i] in constant time.
+class AliasTable {
 public:
-    UniformSampler();
-    float sample();
-private:
-    std::minstd_rand engine;
-};
+    AliasTable();
+    AliasTable(const float* weightsBegin, const float* weightsEnd);
 
-class PiecewiseSampler {
-public:
-    PiecewiseSampler();
-    PiecewiseSampler(const float* weightsBegin, const float* weightsEnd);
-    float sample();
-private:
-    std::minstd_rand engine;
-    std::piecewise_constant_distribution<float> distribution;
-};
+    size_t sample(float uniform) const;
+    size_t size() const { return _probabilities.size(); }
 
-class BarycentricSampler {
-public:
-    vec3 sample();
 private:
-    UniformSampler uniform;
+    vector<float> _probabilities;
+    vector<uint32_t> _aliases;
 };
 
+// Calls func(i) for i in [0, size) in parallel, in chunks of grain indices.
+template <class F> void parallelChunks(size_t size, const F& func, size_t grain = 16 * 1024) {
+    tbb::parallel_for(
+        tbb::blocked_range<size_t>(0, size, grain),
+        [&](const tbb::blocked_range<size_t>& range) {
+            for (size_t i = range.begin(); i < range.end(); ++i) {
+                func(i);
+            }
+        });
+}
+
+uint32_t encodeOctahedral(const vec3& unit);
+vec3 decodeOctahedral(uint32_t packed);
+
+// Images are stored bottom row first, vec4 pixels are divided by w.
+void saveEXR(
+    const string& path,
+    size_t width,
+    size_t height,
+    const vec3* data,
+    bool halfFloat = false);
+
 void saveEXR(
     const string& path,
     size_t width,
     size_t height,
-    const vec3* data);
+    const vec4* data,
+    bool halfFloat = false);
 
+// With albedo, normal and depth layers, albedo.w is the number of samples
+// of the features and normal.w holds the depth.
 void saveEXR(
     const string& path,
     size_t width,
     size_t height,
-    const vec4* data);
+    const vec4* data,
+    const vec4* albedo,
+    const vec4* normal,
+    bool halfFloat = false);
+
+// Writes a tiled EXR one row of tiles at a time, so the whole image never
+// has to be in memory. Tile rows are counted from the top of the image.
+class TiledEXRWriter {
+public:
+    TiledEXRWriter(
+        const string& path,
+        size_t width,
+        size_t height,
+        size_t tileSize,
+        bool features = false,
+        bool halfFloat = false);
+
+    ~TiledEXRWriter();
+
+    TiledEXRWriter(const TiledEXRWriter&) = delete;
+    TiledEXRWriter& operator=(const TiledEXRWriter&) = delete;
+
+    size_t numTileRows() const;
+
+    // Image rows [yBegin, yEnd) of the tile row (bottom row first).
+    size_t yBegin(size_t tileRow) const;
+    size_t yEnd(size_t tileRow) const;
+
+    // Rows holds the pixels of [yBegin, yEnd) of the tile row, divided by w,
+    // albedo and normal likewise if the writer has features.
+    void writeTileRow(
+        size_t tileRow,
+        const vec4* rows,
+        const vec4* albedo = nullptr,
+        const vec4* normal = nullptr);
+
+private:
+    std::unique_ptr<Imf::TiledOutputFile> _file;
+    size_t _width;
+    size_t _height;
+    size_t _tileSize;
+    size_t _numChannels;
+    vector<float> _scratch;
+};
 
 void loadEXR(
     const string& path,
@@ -68,6 +134,117 @@ string fixedPath(string base, string scene, int samples);
 pair<string, string> splitext(string path);
 size_t getmtime(const string& path);
 
+// Monotonic seconds since the first call.
+double secondsSinceStart();
+
+// Read only view of a whole file, data() is nullptr if it cannot be mapped.
+class MappedFile {
+public:
+    MappedFile(const string& path);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char* data() const { return _data; }
+    size_t size() const { return _size; }
+
+private:
+    const char* _data = nullptr;
+    size_t _size = 0;
+};
+
+// Creates a file of given size and lets fill write it through a shared
+// mapping. Written aside and renamed, readers never see a partial file.
+// Fails without calling fill if the disk has no room for the file.
+bool writeMappedFile(const string& path, size_t size, const function<void(char*)>& fill);
+
+// Packs values in native byte order, strings and arrays are stored as an
+// uint64 count followed by the raw elements. Without a buffer only the
+// size is counted, so a file can be measured before writeMappedFile.
+class BinaryWriter {
+public:
+    BinaryWriter(char* cursor = nullptr) : _cursor(cursor) { }
+
+    template <class T> void pod(const T& value) {
+        raw(&value, sizeof(T));
+    }
+
+    template <class T> void array(const T* values, size_t count) {
+        pod(std::uint64_t(count));
+        raw(values, count * sizeof(T));
+    }
+
+    template <class T> void array(const vector<T>& values) {
+        array(values.data(), values.size());
+    }
+
+    void str(const string& value) {
+        array(value.data(), value.size());
+    }
+
+    void raw(const void* data, size_t size);
+    size_t size() const { return _size; }
+
+private:
+    char* _cursor;
+    size_t _size = 0;
+};
+
+// Unpacks what BinaryWriter packed, good() is false once a read went past
+// the end, the reads after that return zeros.
+class BinaryReader {
+public:
+    BinaryReader(const char* begin, const char* end)
+        : _cursor(begin), _end(end) { }
+
+    bool good() const { return _good; }
+
+    template <class T> T pod() {
+        T result = T();
+        raw(&result, sizeof(T));
+        return result;
+    }
+
+    template <class T> void array(vector<T>& values) {
+        std::uint64_t count = pod<std::uint64_t>();
+
+        if (!_good || count > size_t(_end - _cursor) / sizeof(T)) {
+            _good = false;
+            return;
+        }
+
+        values.resize(count);
+        raw(values.data(), count * sizeof(T));
+    }
+
+    string str() {
+        vector<char> chars;
+        array(chars);
+        return string(chars.begin(), chars.end());
+    }
+
+    // Skips count elements of T, returns where they begin.
+    template <class T> const T* skip(size_t count) {
+        const char* result = _cursor;
+
+        if (!_good || count > size_t(_end - _cursor) / sizeof(T)) {
+            _good = false;
+            return nullptr;
+        }
+
+        _cursor += count * sizeof(T);
+        return (const T*)result;
+    }
+
+    void raw(void* dst, size_t size);
+
+private:
+    const char* _cursor;
+    const char* _end;
+    bool _good = true;
+};
+
 void renderPoints(
     vector<vec4>& image,
     size_t width,